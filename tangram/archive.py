@@ -0,0 +1,118 @@
+#!/usr/bin/env python3
+"""Pack a directory of tiles laid out as <z>/<x>/<y>[.ext] into a single
+tile archive, served by tangram for urls archive://<archive>/{z}/{x}/{y}
+
+    python3 tangram/archive.py tiles/ city.tiles
+
+Identical tiles (e.g. empty ocean tiles) are stored once. Empty files are
+kept as present tiles without content. Gzip compressed tiles are stored
+decompressed unless --keep-gzip is given.
+"""
+
+import argparse
+import gzip
+import hashlib
+import os
+import struct
+import sys
+
+MAGIC = 0x52414754  # "TGAR"
+VERSION = 2
+MAX_ZOOM = 29
+MAX_TILE_SIZE = (1 << 32) - 1
+
+TILE_PRESENT = 1
+
+HEADER = struct.Struct('<IIQ')      # magic, version, number of tiles
+RECORD = struct.Struct('<QQII')     # tile id, offset, length, flags
+
+
+def tile_id(z, x, y):
+    return (z << 58) | (x << 29) | y
+
+
+def find_tiles(root):
+    """Yield (z, x, y, path) for every tile file below root"""
+    for z_name in os.listdir(root):
+        z_dir = os.path.join(root, z_name)
+        if not z_name.isdigit() or not os.path.isdir(z_dir):
+            continue
+        z = int(z_name)
+        if z > MAX_ZOOM:
+            print('Skipping zoom %d, archives go up to %d' % (z, MAX_ZOOM), file=sys.stderr)
+            continue
+
+        for x_name in os.listdir(z_dir):
+            x_dir = os.path.join(z_dir, x_name)
+            if not x_name.isdigit() or not os.path.isdir(x_dir):
+                continue
+            x = int(x_name)
+
+            for y_name in os.listdir(x_dir):
+                y_digits = y_name.split('.', 1)[0]
+                path = os.path.join(x_dir, y_name)
+                if not y_digits.isdigit() or not os.path.isfile(path):
+                    continue
+                y = int(y_digits)
+
+                if x >= (1 << z) or y >= (1 << z):
+                    print('Skipping %s, not a tile of zoom %d' % (path, z), file=sys.stderr)
+                    continue
+                yield z, x, y, path
+
+
+def pack(root, output, keep_gzip=False):
+    tiles = sorted(find_tiles(root), key=lambda t: tile_id(t[0], t[1], t[2]))
+
+    ids = [tile_id(z, x, y) for z, x, y, _ in tiles]
+    if len(set(ids)) != len(ids):
+        raise ValueError('Several files for the same tile in %s' % root)
+
+    index = []
+    stored = {}
+    data_size = 0
+    tmp_output = output + '.tmp'
+
+    with open(tmp_output, 'wb') as out:
+        # Data follows the index, which is written last
+        offset = HEADER.size + RECORD.size * len(tiles)
+        out.seek(offset)
+
+        for (z, x, y, path), tid in zip(tiles, ids):
+            with open(path, 'rb') as f:
+                content = f.read()
+            if not keep_gzip and content[:2] == b'\x1f\x8b':
+                content = gzip.decompress(content)
+            if len(content) > MAX_TILE_SIZE:
+                raise ValueError('%s is larger than 4 GB' % path)
+
+            digest = hashlib.sha1(content).digest()
+            if digest not in stored:
+                out.write(content)
+                stored[digest] = (offset, len(content))
+                offset += len(content)
+                data_size += len(content)
+            index.append((tid,) + stored[digest] + (TILE_PRESENT,))
+
+        out.seek(0)
+        out.write(HEADER.pack(MAGIC, VERSION, len(index)))
+        for record in index:
+            out.write(RECORD.pack(*record))
+
+    os.rename(tmp_output, output)
+    return len(index), len(stored), data_size
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Pack a z/x/y tile directory into a tangram tile archive')
+    parser.add_argument('tiles', help='directory holding <z>/<x>/<y>[.ext] files')
+    parser.add_argument('archive', help='archive file to write')
+    parser.add_argument('--keep-gzip', action='store_true', help='store gzip compressed tiles as they are')
+    args = parser.parse_args()
+
+    count, unique, size = pack(args.tiles, args.archive, args.keep_gzip)
+    print('%d tiles (%d unique, %d bytes) packed into %s' % (count, unique, size, args.archive))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,84 @@
+#include "cachePolicy.h"
+
+#include <curl/curl.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <ctime>
+#include <string>
+
+// Upper bound of the heuristic lifetime given to responses that only carry
+// Last-Modified (RFC 7234, 4.2.2)
+#define MAX_HEURISTIC_LIFETIME (24 * 3600)
+
+int64_t cacheTime() {
+    return int64_t(time(nullptr));
+}
+
+static int64_t parseHttpDate(const std::string* _value) {
+    if (!_value) { return -1; }
+    return int64_t(curl_getdate(_value->c_str(), nullptr));
+}
+
+bool cacheExpiry(const UrlResponse& _response, int64_t _now, int64_t& _expires) {
+
+    int64_t lifetime = -1;
+    bool noCache = false;
+
+    if (const std::string* cacheControl = _response.header("cache-control")) {
+        std::string value = *cacheControl;
+        std::transform(value.begin(), value.end(), value.begin(), ::tolower);
+
+        size_t pos = 0;
+        while (pos < value.size()) {
+            size_t end = value.find(',', pos);
+            if (end == std::string::npos) { end = value.size(); }
+
+            size_t begin = value.find_first_not_of(' ', pos);
+            std::string directive = begin < end ? value.substr(begin, end - begin) : "";
+
+            // no-store wins wherever it comes, the header is read to its end
+            if (directive.compare(0, 8, "no-store") == 0) {
+                return false;
+            } else if (directive.compare(0, 8, "no-cache") == 0) {
+                noCache = true;
+            } else if (directive.compare(0, 8, "max-age=") == 0) {
+                lifetime = atoll(directive.c_str() + 8);
+            }
+            pos = end + 1;
+        }
+        // Stored, but revalidated before every use
+        if (noCache) { lifetime = 0; }
+    }
+
+    int64_t date = parseHttpDate(_response.header("date"));
+    if (date < 0) { date = _now; }
+
+    if (lifetime < 0) {
+        int64_t expires = parseHttpDate(_response.header("expires"));
+        if (expires >= 0) {
+            lifetime = expires - date;
+        }
+    }
+
+    const std::string* etag = _response.header("etag");
+    const std::string* lastModified = _response.header("last-modified");
+
+    if (lifetime < 0) {
+        int64_t modified = parseHttpDate(lastModified);
+        if (modified >= 0 && modified < date) {
+            lifetime = std::min<int64_t>((date - modified) / 10, MAX_HEURISTIC_LIFETIME);
+        }
+    }
+
+    if (const std::string* age = _response.header("age")) {
+        lifetime -= atoll(age->c_str());
+    }
+
+    lifetime = std::max<int64_t>(lifetime, 0);
+    _expires = _now + lifetime;
+
+    // An entry that is never fresh and cannot be revalidated is useless
+    return lifetime > 0 || etag || lastModified;
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include "urlClient.h"
+
+#include <cstdint>
+
+// Seconds since the epoch, the clock used for cache expiry
+int64_t cacheTime();
+
+// Compute until when a response stays fresh from its Cache-Control, Expires,
+// Date, Age and Last-Modified headers. Returns false when the response must
+// not be cached at all.
+bool cacheExpiry(const UrlResponse& _response, int64_t _now, int64_t& _expires);
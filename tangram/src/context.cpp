@@ -2,62 +2,256 @@
 
 #include <time.h>
 #include <sys/time.h>
+#include <string.h>
 #include <string>
 #include <iostream>
+#include <mutex>
 
 #include "glm/gtc/matrix_transform.hpp"
 
+#ifdef PLATFORM_RPI
+#include <assert.h>
+#include <fcntl.h>
+#include <iostream>
+#include <termios.h>
+#include <string>
+#include <fstream>
+
+#define check() assert(glGetError() == 0)
+#endif
+
+#ifdef PLATFORM_LINUX
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#ifndef EGL_PLATFORM_SURFACELESS_MESA
+#define EGL_PLATFORM_SURFACELESS_MESA 0x31DD
+#endif
+#endif
+
+#ifdef PLATFORM_RPI
+#define FBO_COLOR_FORMAT GL_RGBA8_OES
+#define FBO_DEPTH_FORMAT GL_DEPTH24_STENCIL8_OES
+#else
+#define FBO_COLOR_FORMAT GL_RGBA8
+#define FBO_DEPTH_FORMAT GL_DEPTH24_STENCIL8
+#endif
+
 // Common global variables
 //----------------------------------------------------
 const std::string appTitle = "Tangram";
-static glm::mat4 orthoMatrix;
 typedef struct {
     float   x,y;
     float   velX,velY;
     int     button;
 } Mouse;
-struct timeval tv;
-static Mouse mouse;
-static glm::ivec4 viewport;
-static double fTime = 0.0f;
-static double fDelta = 0.0f;
+
+// Everything a window or an offscreen context keeps
+struct GLContext {
+    glm::mat4 orthoMatrix;
+    Mouse mouse = {};
+    glm::ivec4 viewport;
+    double fTime = 0.0f;
+    double fDelta = 0.0f;
+
+    bool bHeadless = false;
+    double headlessStart = 0.0;
+    GLuint fbo = 0;
+    GLuint fboColor = 0;
+    GLuint fboDepth = 0;
+
+    void* userData = nullptr;
+
+#ifndef PLATFORM_OSX
+    EGLDisplay display = EGL_NO_DISPLAY;
+    EGLSurface surface = EGL_NO_SURFACE;
+    EGLContext context = EGL_NO_CONTEXT;
+#endif
 
 #ifdef PLATFORM_RPI
-#include <assert.h>
-#include <fcntl.h>
-#include <iostream>
-#include <termios.h>
-#include <string>
-#include <fstream>
+    unsigned long long timeStart = 0;
+    unsigned long long timePrev = 0;
+#else
+    GLFWwindow* window = nullptr;
+    float devicePixelRatio = 1.0;
+#endif
+};
 
-#define check() assert(glGetError() == 0)
+// Context of the calling thread
+static thread_local GLContext* current = nullptr;
+
+// EGL displays and GLFW are shared by all contexts and released with the
+// last one
+static std::mutex contextsMutex;
+static int numContexts = 0;
 
+#ifdef PLATFORM_RPI
 // Raspberry globals
 //----------------------------------------------------
-EGLDisplay display;
-EGLSurface surface;
-EGLContext context;
-
-unsigned long long timeStart;
-unsigned long long timePrev;
 static bool bBcm = false;
 #else
-
 // OSX/Linux globals
 //----------------------------------------------------
-static GLFWwindow* window;
-static float devicePixelRatio = 1.0;
+static bool bGlfw = false;
+// Guards bGlfw for wakeGL() on other threads, held while GLFW starts and ends
+static std::mutex glfwMutex;
+
+// GLFW calls back on the thread polling events for every window, so the
+// callback of another window runs with that window's context current
+struct WindowScope {
+    GLContext* previous;
+    explicit WindowScope(GLFWwindow* _window) : previous(current) {
+        makeCurrentGL(static_cast<GLContext*>(glfwGetWindowUserPointer(_window)));
+    }
+    ~WindowScope() {
+        if (previous) {
+            makeCurrentGL(previous);
+        } else if (current) {
+            current = nullptr;
+            glfwMakeContextCurrent(nullptr);
+        }
+    }
+};
+
+static void initGlfw() {
+    std::lock_guard<std::mutex> lock(glfwMutex);
+    if (!bGlfw) {
+        if(!glfwInit()) {
+            std::cerr << "ABORT: GLFW init failed" << std::endl;
+            exit(-1);
+        }
+        bGlfw = true;
+    }
+}
+#endif
+
+#ifndef PLATFORM_OSX
+static bool hasEGLExtension(EGLDisplay _display, const char* _name) {
+    const char* extensions = eglQueryString(_display, EGL_EXTENSIONS);
+    return extensions && strstr(extensions, _name);
+}
+
+#ifdef PLATFORM_LINUX
+// A display needing no X server: Mesa's surfaceless platform (also with
+// software rendering on machines without GPU) or the first EGL device
+static EGLDisplay headlessDisplay() {
+    auto getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+
+    if (getPlatformDisplay) {
+        if (hasEGLExtension(EGL_NO_DISPLAY, "EGL_MESA_platform_surfaceless")) {
+            EGLDisplay display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+            if (display != EGL_NO_DISPLAY) { return display; }
+        }
+
+        auto queryDevices = (PFNEGLQUERYDEVICESEXTPROC)eglGetProcAddress("eglQueryDevicesEXT");
+        if (queryDevices && hasEGLExtension(EGL_NO_DISPLAY, "EGL_EXT_platform_device")) {
+            EGLDeviceEXT device;
+            EGLint count = 0;
+            if (queryDevices(1, &device, &count) && count > 0) {
+                EGLDisplay display = getPlatformDisplay(EGL_PLATFORM_DEVICE_EXT, device, NULL);
+                if (display != EGL_NO_DISPLAY) { return display; }
+            }
+        }
+    }
+    return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+}
+#endif
 #endif
 
-void initGL (int _width, int _height) {
+static void initHeadlessGL(GLContext* _ctx, int _width, int _height) {
+    _ctx->bHeadless = true;
+
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    _ctx->headlessStart = tv.tv_sec + tv.tv_usec * 0.000001;
+
+    #ifdef PLATFORM_OSX
+        // No EGL, a hidden window provides the context
+        initGlfw();
+
+        glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
+        _ctx->window = glfwCreateWindow(1, 1, appTitle.c_str(), NULL, NULL);
+        if(!_ctx->window) {
+            std::cerr << "ABORT: GLFW create window failed" << std::endl;
+            exit(-1);
+        }
+        glfwSetWindowUserPointer(_ctx->window, _ctx);
+        glfwMakeContextCurrent(_ctx->window);
+    #else
+        #ifdef PLATFORM_RPI
+            if (!bBcm) {
+                bcm_host_init();
+                bBcm = true;
+            }
+            _ctx->display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+            const EGLenum api = EGL_OPENGL_ES_API;
+            const EGLint renderable = EGL_OPENGL_ES2_BIT;
+            const EGLint context_attributes[] = { EGL_CONTEXT_CLIENT_VERSION, 2, EGL_NONE };
+        #else
+            _ctx->display = headlessDisplay();
+            const EGLenum api = EGL_OPENGL_API;
+            const EGLint renderable = EGL_OPENGL_BIT;
+            const EGLint context_attributes[] = { EGL_NONE };
+        #endif
+
+        // Initializing an initialized display does nothing
+        if (_ctx->display == EGL_NO_DISPLAY || !eglInitialize(_ctx->display, NULL, NULL)) {
+            std::cerr << "ABORT: EGL init failed" << std::endl;
+            exit(-1);
+        }
+
+        const EGLint attribute_list[] = {
+            EGL_RED_SIZE, 8,
+            EGL_GREEN_SIZE, 8,
+            EGL_BLUE_SIZE, 8,
+            EGL_ALPHA_SIZE, 8,
+            EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+            EGL_RENDERABLE_TYPE, renderable,
+            EGL_NONE
+        };
+
+        EGLConfig config;
+        EGLint num_config = 0;
+        if (!eglChooseConfig(_ctx->display, attribute_list, &config, 1, &num_config) || num_config < 1 ||
+            !eglBindAPI(api)) {
+            std::cerr << "ABORT: EGL has no offscreen configuration" << std::endl;
+            exit(-1);
+        }
+
+        _ctx->context = eglCreateContext(_ctx->display, config, EGL_NO_CONTEXT, context_attributes);
+
+        // Rendering goes to the framebuffer object, a surface is only needed
+        // where contexts cannot be current without one
+        if (!hasEGLExtension(_ctx->display, "EGL_KHR_surfaceless_context")) {
+            const EGLint pbuffer_attributes[] = { EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE };
+            _ctx->surface = eglCreatePbufferSurface(_ctx->display, config, pbuffer_attributes);
+        }
+
+        if (_ctx->context == EGL_NO_CONTEXT ||
+            !eglMakeCurrent(_ctx->display, _ctx->surface, _ctx->surface, _ctx->context)) {
+            std::cerr << "ABORT: EGL create context failed" << std::endl;
+            exit(-1);
+        }
+    #endif
+
+    glGenFramebuffers(1, &_ctx->fbo);
+    glGenRenderbuffers(1, &_ctx->fboColor);
+    glGenRenderbuffers(1, &_ctx->fboDepth);
+
+    // Allocates the renderbuffers
+    setWindowSize(_width, _height);
+}
+
+static void initWindowGL(GLContext* _ctx, int _width, int _height) {
 
     #ifdef PLATFORM_RPI
         // RASPBERRY_PI
 
         // Start clock
+        struct timeval tv;
         gettimeofday(&tv, NULL);
-        timeStart = (unsigned long long)(tv.tv_sec) * 1000 +
-                    (unsigned long long)(tv.tv_usec) / 1000; 
+        _ctx->timeStart = (unsigned long long)(tv.tv_sec) * 1000 +
+                          (unsigned long long)(tv.tv_usec) / 1000;
 
         // Start OpenGL ES
         if (!bBcm) {
@@ -97,17 +291,17 @@ void initGL (int _width, int _height) {
         EGLConfig config;
 
         // get an EGL display connection
-        display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
-        assert(display!=EGL_NO_DISPLAY);
+        _ctx->display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+        assert(_ctx->display!=EGL_NO_DISPLAY);
         check();
 
         // initialize the EGL display connection
-        result = eglInitialize(display, NULL, NULL);
+        result = eglInitialize(_ctx->display, NULL, NULL);
         assert(EGL_FALSE != result);
         check();
 
         // get an appropriate EGL frame buffer configuration
-        result = eglChooseConfig(display, attribute_list, &config, 1, &num_config);
+        result = eglChooseConfig(_ctx->display, attribute_list, &config, 1, &num_config);
         assert(EGL_FALSE != result);
         check();
 
@@ -117,8 +311,8 @@ void initGL (int _width, int _height) {
         check();
 
         // create an EGL rendering context
-        context = eglCreateContext(display, config, EGL_NO_CONTEXT, context_attributes);
-        assert(context!=EGL_NO_CONTEXT);
+        _ctx->context = eglCreateContext(_ctx->display, config, EGL_NO_CONTEXT, context_attributes);
+        assert(_ctx->context!=EGL_NO_CONTEXT);
         check();
 
         //  Initially the viewport is for all the screen
@@ -145,12 +339,12 @@ void initGL (int _width, int _height) {
         vc_dispmanx_update_submit_sync( dispman_update );
         check();
 
-        surface = eglCreateWindowSurface( display, config, &nativeviewport, NULL );
-        assert(surface != EGL_NO_SURFACE);
+        _ctx->surface = eglCreateWindowSurface( _ctx->display, config, &nativeviewport, NULL );
+        assert(_ctx->surface != EGL_NO_SURFACE);
         check();
 
         // connect the context to the surface
-        result = eglMakeCurrent(display, surface, surface, context);
+        result = eglMakeCurrent(_ctx->display, _ctx->surface, _ctx->surface, _ctx->context);
         assert(EGL_FALSE != result);
         check();
 
@@ -158,36 +352,39 @@ void initGL (int _width, int _height) {
     #else
         // OSX/LINUX use GLFW
         // ---------------------------------------------
-        if(!glfwInit()) {
-            std::cerr << "ABORT: GLFW init failed" << std::endl;
-            exit(-1);
-        }
+        initGlfw();
 
-        window = glfwCreateWindow(_width, _height, appTitle.c_str(), NULL, NULL);
-        
-        if(!window) {
-            glfwTerminate();
+        _ctx->window = glfwCreateWindow(_width, _height, appTitle.c_str(), NULL, NULL);
+
+        if(!_ctx->window) {
             std::cerr << "ABORT: GLFW create window failed" << std::endl;
             exit(-1);
         }
+        glfwSetWindowUserPointer(_ctx->window, _ctx);
 
-        devicePixelRatio = getDevicePixelRatio();
-        setWindowSize(_width*devicePixelRatio, _height*devicePixelRatio);
+        _ctx->devicePixelRatio = getDevicePixelRatio();
+        setWindowSize(_width*_ctx->devicePixelRatio, _height*_ctx->devicePixelRatio);
 
-        glfwMakeContextCurrent(window);
-        glfwSetWindowSizeCallback(window, [](GLFWwindow* _window, int _w, int _h) {
-            devicePixelRatio = getDevicePixelRatio();
-            setWindowSize(_w*devicePixelRatio,_h*devicePixelRatio);
+        glfwMakeContextCurrent(_ctx->window);
+        glfwSetWindowSizeCallback(_ctx->window, [](GLFWwindow* _window, int _w, int _h) {
+            WindowScope scope(_window);
+            current->devicePixelRatio = getDevicePixelRatio();
+            setWindowSize(_w*current->devicePixelRatio,_h*current->devicePixelRatio);
         });
 
-        glfwSetKeyCallback(window, [](GLFWwindow* _window, int _key, int _scancode, int _action, int _mods) {
+        glfwSetKeyCallback(_ctx->window, [](GLFWwindow* _window, int _key, int _scancode, int _action, int _mods) {
+            WindowScope scope(_window);
             onKeyPress(_key);
         });
 
-        glfwSetCursorPosCallback(window, [](GLFWwindow* _window, double x, double y) {
+        glfwSetCursorPosCallback(_ctx->window, [](GLFWwindow* _window, double x, double y) {
+            WindowScope scope(_window);
+            Mouse& mouse = current->mouse;
+            const glm::ivec4& viewport = current->viewport;
+
             // Update stuff
-            x *= devicePixelRatio;
-            y *= devicePixelRatio;
+            x *= current->devicePixelRatio;
+            y *= current->devicePixelRatio;
 
             mouse.velX = x - mouse.x;
             mouse.velY = (viewport.w - y) - mouse.y;
@@ -199,8 +396,8 @@ void initGL (int _width, int _height) {
             if (mouse.x > viewport.z) mouse.x = viewport.z;
             if (mouse.y > viewport.w) mouse.y = viewport.w;
 
-            int action1 = glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_1);
-            int action2 = glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_2);
+            int action1 = glfwGetMouseButton(_window, GLFW_MOUSE_BUTTON_1);
+            int action2 = glfwGetMouseButton(_window, GLFW_MOUSE_BUTTON_2);
             int button = 0;
 
             if (action1 == GLFW_PRESS) button = 1;
@@ -210,7 +407,7 @@ void initGL (int _width, int _height) {
             if (mouse.button == 0 && button != mouse.button) {
                 mouse.button = button;
                 onMouseClick(mouse.x,mouse.y,mouse.button);
-            } 
+            }
             else {
                 mouse.button = button;
             }
@@ -218,26 +415,29 @@ void initGL (int _width, int _height) {
             if (mouse.velX != 0.0 || mouse.velY != 0.0) {
                 if (button != 0) onMouseDrag(mouse.x,mouse.y,mouse.button);
                 else onMouseMove(mouse.x,mouse.y);
-            }    
+            }
         });
 
-        glfwSetScrollCallback(window, [](GLFWwindow* _window, double scrollx, double scrolly) {
+        glfwSetScrollCallback(_ctx->window, [](GLFWwindow* _window, double scrollx, double scrolly) {
+            WindowScope scope(_window);
+
             double x, y;
-            glfwGetCursorPos(window, &x, &y);
-            x *= devicePixelRatio;
-            y *= devicePixelRatio;
+            glfwGetCursorPos(_window, &x, &y);
+            x *= current->devicePixelRatio;
+            y *= current->devicePixelRatio;
 
             ScrollType type = PINCH;
-            if (glfwGetKey(window, GLFW_KEY_LEFT_ALT) == GLFW_PRESS || glfwGetKey(window, GLFW_KEY_RIGHT_ALT) == GLFW_PRESS) {
+            if (glfwGetKey(_window, GLFW_KEY_LEFT_ALT) == GLFW_PRESS || glfwGetKey(_window, GLFW_KEY_RIGHT_ALT) == GLFW_PRESS) {
                 type = ROTATE;
-            } else if ( glfwGetKey(window, GLFW_KEY_LEFT_CONTROL) == GLFW_PRESS || glfwGetKey(window, GLFW_KEY_RIGHT_CONTROL) == GLFW_PRESS ) {
+            } else if ( glfwGetKey(_window, GLFW_KEY_LEFT_CONTROL) == GLFW_PRESS || glfwGetKey(_window, GLFW_KEY_RIGHT_CONTROL) == GLFW_PRESS ) {
                 type = SHOVE;
             }
 
             onScroll(x, y, scrollx, scrolly, type);
         });
 
-        glfwSetDropCallback(window, [](GLFWwindow* _window, int count, const char** paths) {
+        glfwSetDropCallback(_ctx->window, [](GLFWwindow* _window, int count, const char** paths) {
+            WindowScope scope(_window);
             onDrop(count, paths);
         });
 
@@ -245,17 +445,151 @@ void initGL (int _width, int _height) {
     #endif
 }
 
+GLContext* createGL(int _width, int _height, bool _headless, void* _userData) {
+    std::lock_guard<std::mutex> lock(contextsMutex);
+
+    GLContext* ctx = new GLContext();
+    ctx->userData = _userData;
+    current = ctx;
+
+    if (_headless) {
+        initHeadlessGL(ctx, _width, _height);
+    } else {
+        initWindowGL(ctx, _width, _height);
+    }
+
+    numContexts++;
+    return ctx;
+}
+
+void makeCurrentGL(GLContext* _ctx) {
+    if (current == _ctx) { return; }
+    current = _ctx;
+
+    if (!_ctx) { return; }
+
+    #ifdef PLATFORM_OSX
+        glfwMakeContextCurrent(_ctx->window);
+    #else
+        #ifndef PLATFORM_RPI
+        if (!_ctx->bHeadless) {
+            glfwMakeContextCurrent(_ctx->window);
+            return;
+        }
+        #endif
+        eglMakeCurrent(_ctx->display, _ctx->surface, _ctx->surface, _ctx->context);
+    #endif
+}
+
+void destroyGL(GLContext* _ctx) {
+    if (!_ctx) { return; }
+
+    std::lock_guard<std::mutex> lock(contextsMutex);
+    makeCurrentGL(_ctx);
+
+    bool last = (--numContexts == 0);
+
+    if (_ctx->bHeadless) {
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glDeleteFramebuffers(1, &_ctx->fbo);
+        glDeleteRenderbuffers(1, &_ctx->fboColor);
+        glDeleteRenderbuffers(1, &_ctx->fboDepth);
+    }
+
+    #ifdef PLATFORM_RPI
+        // RASPBERRY_PI
+        if (!_ctx->bHeadless) {
+            eglSwapBuffers(_ctx->display, _ctx->surface);
+        }
+    #endif
+
+    #ifndef PLATFORM_OSX
+    if (_ctx->context != EGL_NO_CONTEXT) {
+        // Release OpenGL resources
+        eglMakeCurrent(_ctx->display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        if (_ctx->surface != EGL_NO_SURFACE) { eglDestroySurface(_ctx->display, _ctx->surface); }
+        eglDestroyContext(_ctx->display, _ctx->context);
+        if (last) { eglTerminate(_ctx->display); }
+    }
+    #endif
+
+    #ifndef PLATFORM_RPI
+    if (_ctx->window) {
+        // OSX/LINUX
+        glfwDestroyWindow(_ctx->window);
+    }
+    if (last) {
+        std::lock_guard<std::mutex> lock(glfwMutex);
+        if (bGlfw) {
+            glfwTerminate();
+            bGlfw = false;
+        }
+    }
+    #endif
+
+    current = nullptr;
+    delete _ctx;
+}
+
+void wakeGL() {
+    #ifndef PLATFORM_RPI
+    std::lock_guard<std::mutex> lock(glfwMutex);
+    if (bGlfw) {
+        glfwPostEmptyEvent();
+    }
+    #endif
+}
+
+GLContext* currentGL() {
+    return current;
+}
+
+void* getGLUserData() {
+    return current ? current->userData : nullptr;
+}
+
+void initGL (int _width, int _height, bool _headless) {
+    createGL(_width, _height, _headless, nullptr);
+}
+
 bool isGL(){
+    if (!current) {
+        return false;
+    }
+
+    if (current->bHeadless) {
+        return current->fbo != 0;
+    }
+
     #ifdef PLATFORM_RPI
         // RASPBERRY_PI
         return bBcm;
     #else
         // OSX/LINUX
-        return !glfwWindowShouldClose(window);
+        return !glfwWindowShouldClose(current->window);
     #endif
 }
 
-void updateGL(){
+bool isHeadless() {
+    return current && current->bHeadless;
+}
+
+void updateGL(double _wait){
+    GLContext* ctx = current;
+    struct timeval tv;
+
+    if (ctx->bHeadless) {
+        // No events to poll, only the clock moves
+        gettimeofday(&tv, NULL);
+        double now = tv.tv_sec + tv.tv_usec * 0.000001 - ctx->headlessStart;
+        ctx->fDelta = now - ctx->fTime;
+        ctx->fTime = now;
+
+        // The map draws into the framebuffer object
+        glBindFramebuffer(GL_FRAMEBUFFER, ctx->fbo);
+        return;
+    }
+
     // Update time
     // --------------------------------------------------------------------
     #ifdef PLATFORM_RPI
@@ -264,27 +598,23 @@ void updateGL(){
         unsigned long long timeNow =    (unsigned long long)(tv.tv_sec) * 1000 +
                                         (unsigned long long)(tv.tv_usec) / 1000;
 
-        fTime = (timeNow - timeStart)*0.001;
-        fDelta = (timeNow - timePrev)*0.001;
-        timePrev = timeNow;
+        ctx->fTime = (timeNow - ctx->timeStart)*0.001;
+        ctx->fDelta = (timeNow - ctx->timePrev)*0.001;
+        ctx->timePrev = timeNow;
     #else
         // OSX/LINUX
         double now = glfwGetTime();
-        fDelta = now - fTime;
-        fTime = now;
-
-        static int frame_count = 0.;
-        if (fDelta > 0.25) {
-            glfwSetWindowTitle(window, appTitle.c_str());
-            frame_count = 0;
-        }
-        frame_count++;
+        ctx->fDelta = now - ctx->fTime;
+        ctx->fTime = now;
     #endif
 
     // EVENTS
     // --------------------------------------------------------------------
     #ifdef PLATFORM_RPI
         // RASPBERRY_PI
+        Mouse& mouse = ctx->mouse;
+        const glm::ivec4& viewport = ctx->viewport;
+
         static int fd = -1;
         const int XSIGN = 1<<4, YSIGN = 1<<5;
         if (fd<0) {
@@ -294,36 +624,36 @@ void updateGL(){
             // Set values to 0
             mouse.velX=0;
             mouse.velY=0;
-            
+
             // Extract values from driver
             struct {char buttons, dx, dy; } m;
             while (1) {
                 int bytes = read(fd, &m, sizeof m);
-                
+
                 if (bytes < (int)sizeof m) {
                     return;
                 } else if (m.buttons&8) {
                     break; // This bit should always be set
                 }
-                
+
                 read(fd, &m, 1); // Try to sync up again
             }
-            
+
             // Set button value
             int button = m.buttons&3;
             if (button) mouse.button = button;
             else mouse.button = 0;
-            
+
             // Set deltas
             mouse.velX=m.dx;
             mouse.velY=m.dy;
             if (m.buttons&XSIGN) mouse.velX-=256;
             if (m.buttons&YSIGN) mouse.velY-=256;
-            
+
             // Add movement
             mouse.x+=mouse.velX;
             mouse.y+=mouse.velY;
-            
+
             // Clamp values
             if (mouse.x < 0) mouse.x=0;
             if (mouse.y < 0) mouse.y=0;
@@ -334,7 +664,7 @@ void updateGL(){
             if (mouse.button == 0 && button != mouse.button) {
                 mouse.button = button;
                 onMouseClick(mouse.x, mouse.y, mouse.button);
-            } 
+            }
             else {
                 mouse.button = button;
             }
@@ -346,53 +676,86 @@ void updateGL(){
         }
     #else
         // OSX/LINUX
-        glfwPollEvents();
+        if (_wait > 0.0) {
+            glfwWaitEventsTimeout(_wait);
+        } else {
+            glfwPollEvents();
+        }
     #endif
 }
 
 void renderGL(){
+    if (current->bHeadless) {
+        // Nothing to present, the frame stays in the framebuffer object
+        glFlush();
+        return;
+    }
+
     #ifdef PLATFORM_RPI
         // RASPBERRY_PI
-        eglSwapBuffers(display, surface);
+        eglSwapBuffers(current->display, current->surface);
     #else
         // OSX/LINUX
-        glfwSwapBuffers(window);
-        glfwPollEvents();
+        glfwSwapBuffers(current->window);
     #endif
 }
 
 void closeGL(){
+    destroyGL(current);
+}
+//-------------------------------------------------------------
+
+void setVsync(bool _enabled) {
+    // Offscreen frames are never presented
+    if (!current || current->bHeadless) { return; }
+
     #ifdef PLATFORM_RPI
         // RASPBERRY_PI
-        eglSwapBuffers(display, surface);
-        // Release OpenGL resources
-        eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
-        eglDestroySurface(display, surface);
-        eglDestroyContext(display, context);
-        eglTerminate(display);
+        eglSwapInterval(current->display, _enabled ? 1 : 0);
     #else
         // OSX/LINUX
-        glfwSetWindowShouldClose(window, GL_TRUE);
-        glfwTerminate();
+        glfwSwapInterval(_enabled ? 1 : 0);
     #endif
 }
-//-------------------------------------------------------------
 
 void setWindowSize(int _width, int _height) {
+    GLContext* ctx = current;
+
+    if (ctx->bHeadless) {
+        glBindRenderbuffer(GL_RENDERBUFFER, ctx->fboColor);
+        glRenderbufferStorage(GL_RENDERBUFFER, FBO_COLOR_FORMAT, _width, _height);
+        glBindRenderbuffer(GL_RENDERBUFFER, ctx->fboDepth);
+        glRenderbufferStorage(GL_RENDERBUFFER, FBO_DEPTH_FORMAT, _width, _height);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, ctx->fbo);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, ctx->fboColor);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, ctx->fboDepth);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_STENCIL_ATTACHMENT, GL_RENDERBUFFER, ctx->fboDepth);
+
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            std::cerr << "Offscreen framebuffer of " << _width << "x" << _height << " is incomplete" << std::endl;
+        }
+    }
+
+    glm::ivec4& viewport = ctx->viewport;
     viewport.z = _width;
     viewport.w = _height;
     glViewport(0.0, 0.0, (float)viewport.z, (float)viewport.w);
-    orthoMatrix = glm::ortho((float)viewport.x, (float)viewport.z, (float)viewport.y, (float)viewport.w);
+    ctx->orthoMatrix = glm::ortho((float)viewport.x, (float)viewport.z, (float)viewport.y, (float)viewport.w);
 
     onViewportResize(viewport.z, viewport.w);
 }
 
 glm::ivec2 getScreenSize() {
     glm::ivec2 screen;
-    
+
+    if (current->bHeadless) {
+        return glm::ivec2(current->viewport.z, current->viewport.w);
+    }
+
     #ifdef PLATFORM_RPI
         // RASPBERRYPI
-        
+
         if (!bBcm) {
             bcm_host_init();
             bBcm = true;
@@ -411,39 +774,44 @@ glm::ivec2 getScreenSize() {
 }
 
 float getDevicePixelRatio() {
+    if (current->bHeadless) {
+        return 1.;
+    }
+
     #ifdef PLATFORM_RPI
         // RASPBERRYPI
         return 1.;
     #else
         // OSX/LINUX
         int window_width, window_height, framebuffer_width, framebuffer_height;
-        glfwGetWindowSize(window, &window_width, &window_height);
-        glfwGetFramebufferSize(window, &framebuffer_width, &framebuffer_height);
+        glfwGetWindowSize(current->window, &window_width, &window_height);
+        glfwGetFramebufferSize(current->window, &framebuffer_width, &framebuffer_height);
         return framebuffer_width/window_width;
     #endif
 }
 
 int getWindowWidth() {
-    return viewport.z;
+    return current->viewport.z;
 }
 
 int getWindowHeight() {
-    return viewport.w;
+    return current->viewport.w;
 }
 
 glm::mat4 getOrthoMatrix() {
-    return orthoMatrix;
+    return current->orthoMatrix;
 }
 
 double getTime() {
-    return fTime;
+    return current->fTime;
 }
 
 double getDelta() {
-    return fDelta;
+    return current->fDelta;
 }
 
 glm::vec4 getDate() {
+    struct timeval tv;
     gettimeofday(&tv, NULL);
     struct tm *tm;
     tm = localtime(&tv.tv_sec);
@@ -454,29 +822,29 @@ glm::vec4 getDate() {
 }
 
 float getMouseX(){
-    return mouse.x;
+    return current->mouse.x;
 }
 
 float getMouseY(){
-    return mouse.y;
+    return current->mouse.y;
 }
 
 glm::vec2 getMousePosition() {
-    return glm::vec2(mouse.x,mouse.y);
+    return glm::vec2(current->mouse.x,current->mouse.y);
 }
 
 float getMouseVelX(){
-    return mouse.velX;
+    return current->mouse.velX;
 }
 
 float getMouseVelY(){
-    return mouse.velY;
+    return current->mouse.velY;
 }
 
 glm::vec2 getMouseVelocity() {
-    return glm::vec2(mouse.velX,mouse.velY);
+    return glm::vec2(current->mouse.velX,current->mouse.velY);
 }
 
 int getMouseButton(){
-    return mouse.button;
+    return current->mouse.button;
 }
@@ -14,14 +14,39 @@ enum ScrollType {
 
 //  GL Context
 //----------------------------------------------
-void initGL(int _width, int _height);
+// Window or offscreen context with its viewport, clock and input. Every
+// thread has a current context the functions below work on; a context
+// belongs to the thread that created it, or to one at a time. GLFW allows
+// windows on the main thread only, and polling there dispatches the events
+// of all of them
+struct GLContext;
+
+// Create a context and make it current. A headless context has no window
+// and no input: it renders offscreen into a framebuffer object of the
+// viewport size. _userData is handed back by getGLUserData(), e.g. in the
+// event callbacks of its window
+GLContext* createGL(int _width, int _height, bool _headless, void* _userData);
+void makeCurrentGL(GLContext* _ctx);
+void destroyGL(GLContext* _ctx);
+GLContext* currentGL();
+void* getGLUserData();
+// Wake the windows waiting for events in updateGL(), from any thread. Does
+// nothing while no window system is up, e.g. headless on Linux
+void wakeGL();
+
+void initGL(int _width, int _height, bool _headless = false);
 bool isGL();
-void updateGL();
+bool isHeadless();
+// Poll input and advance the clock; a window blocks up to _wait seconds for
+// an event first
+void updateGL(double _wait = 0.0);
 void renderGL();
 void closeGL();
 
 //  SET
 //----------------------------------------------
+// Wait for the display refresh on swap (the default for windows)
+void setVsync(bool _enabled);
 void setWindowSize(int _width, int _height);
 
 //  GET
@@ -0,0 +1,440 @@
+#include "diskCache.h"
+#include "cachePolicy.h"
+#include "fileView.h"
+#include "log.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <iterator>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define INDEX_MAGIC 0x43445447      // "GTDC"
+#define BLOB_MAGIC 0x42445447       // "GTDB"
+#define INDEX_VERSION 1
+
+// Index writes happen at most every FLUSH_INTERVAL changes and on shutdown
+#define FLUSH_INTERVAL 64
+
+struct IndexHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t count;
+};
+
+struct IndexRecord {
+    uint64_t key;
+    uint64_t size;
+    int64_t expires;
+    int64_t lastAccess;
+};
+
+// A blob file is this header followed by url, etag, last-modified and content
+struct BlobHeader {
+    uint32_t magic;
+    uint32_t urlLength;
+    uint32_t etagLength;
+    uint32_t lastModifiedLength;
+    uint64_t contentLength;
+};
+
+static uint64_t hashUrl(const std::string& _url) {
+    // FNV-1a
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (unsigned char c : _url) {
+        hash ^= c;
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static bool makeDirectory(const std::string& _path) {
+    for (size_t pos = 1; pos <= _path.size(); pos++) {
+        if (pos == _path.size() || _path[pos] == '/') {
+            std::string dir = _path.substr(0, pos);
+            if (mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+DiskCache::DiskCache(const std::string& _path, uint64_t _maxBytes)
+    : m_path(_path), m_maxBytes(_maxBytes) {
+
+    if (!makeDirectory(m_path)) {
+        LOGE("Cannot create cache directory %s", m_path.c_str());
+        return;
+    }
+
+    loadIndex();
+    unlinkBlobs(evict());
+
+    m_valid = true;
+}
+
+DiskCache::~DiskCache() {
+    if (m_valid) {
+        flush();
+    }
+}
+
+std::string DiskCache::blobPath(uint64_t _key) const {
+    char name[32];
+    snprintf(name, sizeof(name), "/%02x/%016llx", unsigned(_key >> 56), (unsigned long long)_key);
+    return m_path + name;
+}
+
+DiskCache::Lookup DiskCache::lookup(const std::string& _url) {
+
+    Lookup result;
+    uint64_t key = hashUrl(_url);
+    int64_t now = cacheTime();
+    bool fresh = false;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        auto it = m_entries.find(key);
+        if (it == m_entries.end()) {
+            m_stats.misses++;
+            return result;
+        }
+        fresh = it->second.expires > now;
+        result.expires = it->second.expires;
+        touch(key, it->second, now);
+    }
+
+    bool valid = readBlob(key, _url, result, fresh);
+
+    if (!valid) {
+        // Missing, damaged or taken by another url
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            remove(key);
+            m_stats.misses++;
+        }
+        unlinkBlobs({ key });
+        return Lookup();
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    result.found = true;
+    result.fresh = fresh;
+    if (fresh) {
+        m_stats.hits++;
+    } else {
+        m_stats.misses++;
+    }
+    return result;
+}
+
+bool DiskCache::isFresh(const std::string& _url) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto it = m_entries.find(hashUrl(_url));
+    return it != m_entries.end() && it->second.expires > cacheTime();
+}
+
+void DiskCache::store(const std::string& _url, const UrlResponse& _response) {
+
+    if (_response.status != 200) { return; }
+
+    uint64_t key = hashUrl(_url);
+    int64_t now = cacheTime();
+    int64_t expires = 0;
+
+    if (!cacheExpiry(_response, now, expires)) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_entries.count(key)) {
+            remove(key);
+            unlink(blobPath(key).c_str());
+        }
+        return;
+    }
+
+    const std::string* etag = _response.header("etag");
+    const std::string* lastModified = _response.header("last-modified");
+
+    if (!writeBlob(key, _url, etag ? *etag : "", lastModified ? *lastModified : "", _response.content)) {
+        return;
+    }
+
+    uint64_t size = sizeof(BlobHeader) + _url.size() + _response.content.size() +
+        (etag ? etag->size() : 0) + (lastModified ? lastModified->size() : 0);
+
+    std::vector<uint64_t> evicted;
+    bool needFlush = false;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        auto it = m_entries.find(key);
+        if (it == m_entries.end()) {
+            m_lru.push_front(key);
+            it = m_entries.emplace(key, Entry{ 0, 0, 0, m_lru.begin() }).first;
+        } else {
+            m_totalBytes -= it->second.size;
+        }
+        it->second.size = size;
+        it->second.expires = expires;
+        touch(key, it->second, now);
+        m_totalBytes += size;
+
+        evicted = evict();
+        needFlush = ++m_unflushed >= FLUSH_INTERVAL;
+    }
+
+    unlinkBlobs(evicted);
+
+    if (needFlush) { flush(); }
+}
+
+bool DiskCache::revalidate(const std::string& _url, const UrlResponse& _response, std::vector<char>& _content) {
+
+    uint64_t key = hashUrl(_url);
+    int64_t now = cacheTime();
+
+    Lookup cached;
+    bool valid = readBlob(key, _url, cached, true);
+
+    int64_t expires = 0;
+    bool keep = cacheExpiry(_response, now, expires);
+
+    bool revalidated = false;
+    bool removed = false;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        auto it = m_entries.find(key);
+        if (it != m_entries.end()) {
+            if (valid && keep) {
+                it->second.expires = expires;
+                touch(key, it->second, now);
+            } else {
+                remove(key);
+                removed = true;
+            }
+            revalidated = valid;
+        }
+        if (revalidated) {
+            m_stats.revalidated++;
+            m_unflushed++;
+        }
+    }
+
+    // Like evicted blobs, deleted outside the lock
+    if (removed) { unlinkBlobs({ key }); }
+    if (!revalidated) { return false; }
+
+    _content = std::move(cached.content);
+    return true;
+}
+
+DiskCache::Stats DiskCache::stats() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    Stats stats = m_stats;
+    stats.entries = m_entries.size();
+    stats.bytes = m_totalBytes;
+    return stats;
+}
+
+void DiskCache::touch(uint64_t _key, Entry& _entry, int64_t _now) {
+    _entry.lastAccess = _now;
+    m_lru.splice(m_lru.begin(), m_lru, _entry.lru);
+}
+
+void DiskCache::remove(uint64_t _key) {
+    auto it = m_entries.find(_key);
+    if (it == m_entries.end()) { return; }
+
+    m_totalBytes -= it->second.size;
+    m_lru.erase(it->second.lru);
+    m_entries.erase(it);
+    m_unflushed++;
+}
+
+std::vector<uint64_t> DiskCache::evict() {
+    std::vector<uint64_t> evicted;
+
+    while (m_totalBytes > m_maxBytes && !m_lru.empty()) {
+        uint64_t key = m_lru.back();
+        remove(key);
+        evicted.push_back(key);
+    }
+    return evicted;
+}
+
+void DiskCache::unlinkBlobs(const std::vector<uint64_t>& _keys) {
+    for (uint64_t key : _keys) {
+        unlink(blobPath(key).c_str());
+    }
+}
+
+bool DiskCache::readBlob(uint64_t _key, const std::string& _url, Lookup& _lookup, bool _withContent) {
+
+    // Read front to back straight into the lookup: the body is copied out
+    // anyway, a mapping would only add its pages to the copy
+    size_t size = 0;
+    int fd = openFile(blobPath(_key).c_str(), size, true);
+    if (fd < 0) { return false; }
+
+    BlobHeader header = {};
+    bool valid = size >= sizeof(header) && readFully(fd, reinterpret_cast<char*>(&header), sizeof(header));
+
+    uint64_t total = uint64_t(sizeof(header)) + header.urlLength + header.etagLength +
+        header.lastModifiedLength + header.contentLength;
+    valid = valid && header.magic == BLOB_MAGIC && total == size;
+
+    std::string fields;
+    if (valid) {
+        fields.resize(size_t(header.urlLength) + header.etagLength + header.lastModifiedLength);
+        valid = readFully(fd, &fields[0], fields.size()) &&
+            fields.compare(0, header.urlLength, _url) == 0;
+    }
+
+    if (valid) {
+        size_t offset = header.urlLength;
+        _lookup.etag.assign(fields, offset, header.etagLength);
+        offset += header.etagLength;
+        _lookup.lastModified.assign(fields, offset, header.lastModifiedLength);
+
+        if (_withContent) {
+            _lookup.content.resize(header.contentLength);
+            valid = readFully(fd, _lookup.content.data(), header.contentLength);
+            if (!valid) { _lookup.content.clear(); }
+        }
+    }
+    close(fd);
+    return valid;
+}
+
+bool DiskCache::writeBlob(uint64_t _key, const std::string& _url, const std::string& _etag,
+                          const std::string& _lastModified, const std::vector<char>& _content) {
+
+    std::string path = blobPath(_key);
+    std::string dir = path.substr(0, path.rfind('/'));
+    mkdir(dir.c_str(), 0755);
+
+    // Write to a private file and rename it in place, readers never see
+    // a partial blob
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), ".%lx.tmp", (unsigned long)pthread_self());
+    std::string tmpPath = path + suffix;
+
+    FILE* file = fopen(tmpPath.c_str(), "wb");
+    if (!file) {
+        LOGW("Cannot write cache file %s", tmpPath.c_str());
+        return false;
+    }
+
+    BlobHeader header;
+    header.magic = BLOB_MAGIC;
+    header.urlLength = _url.size();
+    header.etagLength = _etag.size();
+    header.lastModifiedLength = _lastModified.size();
+    header.contentLength = _content.size();
+
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+        fwrite(_url.data(), 1, _url.size(), file) == _url.size() &&
+        fwrite(_etag.data(), 1, _etag.size(), file) == _etag.size() &&
+        fwrite(_lastModified.data(), 1, _lastModified.size(), file) == _lastModified.size() &&
+        fwrite(_content.data(), 1, _content.size(), file) == _content.size();
+
+    ok = (fclose(file) == 0) && ok;
+
+    if (!ok || rename(tmpPath.c_str(), path.c_str()) != 0) {
+        unlink(tmpPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+void DiskCache::loadIndex() {
+
+    std::string path = m_path + "/index";
+
+    FILE* file = fopen(path.c_str(), "rb");
+    if (!file) { return; }
+
+    IndexHeader header;
+    std::vector<IndexRecord> records;
+
+    if (fread(&header, sizeof(header), 1, file) == 1 &&
+        header.magic == INDEX_MAGIC && header.version == INDEX_VERSION) {
+
+        // The count is checked against the file before it sizes anything, a
+        // damaged one could ask for gigabytes
+        struct stat st;
+        uint64_t available = fstat(fileno(file), &st) == 0 && uint64_t(st.st_size) > sizeof(header)
+            ? uint64_t(st.st_size) - sizeof(header) : 0;
+
+        if (header.count != available / sizeof(IndexRecord) || available % sizeof(IndexRecord) != 0) {
+            LOGW("Truncated cache index %s", path.c_str());
+        } else {
+            records.resize(header.count);
+            if (fread(records.data(), sizeof(IndexRecord), records.size(), file) != records.size()) {
+                LOGW("Truncated cache index %s", path.c_str());
+                records.clear();
+            }
+        }
+    }
+    fclose(file);
+
+    // Most recently used first
+    std::sort(records.begin(), records.end(), [](const IndexRecord& _a, const IndexRecord& _b) {
+        return _a.lastAccess > _b.lastAccess;
+    });
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    for (auto& record : records) {
+        if (m_entries.count(record.key)) { continue; }
+
+        m_lru.push_back(record.key);
+        m_entries.emplace(record.key, Entry{ record.size, record.expires, record.lastAccess, std::prev(m_lru.end()) });
+        m_totalBytes += record.size;
+    }
+}
+
+void DiskCache::flush() {
+    std::lock_guard<std::mutex> flushLock(m_flushMutex);
+
+    std::vector<IndexRecord> records;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        records.reserve(m_entries.size());
+        for (auto& entry : m_entries) {
+            records.push_back({ entry.first, entry.second.size, entry.second.expires, entry.second.lastAccess });
+        }
+        m_unflushed = 0;
+    }
+
+    std::string path = m_path + "/index";
+    std::string tmpPath = path + ".tmp";
+
+    FILE* file = fopen(tmpPath.c_str(), "wb");
+    if (!file) {
+        LOGW("Cannot write cache index %s", tmpPath.c_str());
+        return;
+    }
+
+    IndexHeader header = { INDEX_MAGIC, INDEX_VERSION, records.size() };
+
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+        fwrite(records.data(), sizeof(IndexRecord), records.size(), file) == records.size();
+
+    ok = (fclose(file) == 0) && ok;
+
+    if (!ok || rename(tmpPath.c_str(), path.c_str()) != 0) {
+        unlink(tmpPath.c_str());
+    }
+}
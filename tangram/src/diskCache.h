@@ -0,0 +1,98 @@
+#pragma once
+
+#include "urlClient.h"
+
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Persistent cache of HTTP responses below startUrlRequest(). Every body is
+// stored in its own file under the cache directory and read back with plain
+// reads into the returned buffer; a compact binary index keeps size, expiry and last use of each
+// entry so the cache stays within its byte budget by evicting the least
+// recently used entries. Freshness follows Cache-Control, Expires and ETag or
+// Last-Modified validators.
+class DiskCache {
+
+public:
+
+    struct Stats {
+        uint64_t hits = 0;          // served fresh from disk
+        uint64_t misses = 0;        // went to the network
+        uint64_t revalidated = 0;   // misses answered with 304 Not Modified
+        uint64_t entries = 0;
+        uint64_t bytes = 0;
+    };
+
+    struct Lookup {
+        bool found = false;
+        // Fresh entries come with their content, stale ones only with the
+        // validators needed for a conditional request
+        bool fresh = false;
+        int64_t expires = 0;
+        std::vector<char> content;
+        std::string etag;
+        std::string lastModified;
+    };
+
+    DiskCache(const std::string& _path, uint64_t _maxBytes);
+    ~DiskCache();
+
+    bool isValid() const { return m_valid; }
+
+    Lookup lookup(const std::string& _url);
+
+    // Whether a fresh entry for _url exists, without reading it
+    bool isFresh(const std::string& _url);
+
+    // Keep a 200 response if its headers allow it
+    void store(const std::string& _url, const UrlResponse& _response);
+
+    // Extend the lifetime of the entry for _url after a 304 response and
+    // read its content
+    bool revalidate(const std::string& _url, const UrlResponse& _response, std::vector<char>& _content);
+
+    Stats stats();
+
+    // Write the index to disk
+    void flush();
+
+private:
+
+    struct Entry {
+        uint64_t size;
+        int64_t expires;
+        int64_t lastAccess;
+        std::list<uint64_t>::iterator lru;
+    };
+
+    std::string blobPath(uint64_t _key) const;
+
+    bool readBlob(uint64_t _key, const std::string& _url, Lookup& _lookup, bool _withContent);
+    bool writeBlob(uint64_t _key, const std::string& _url, const std::string& _etag,
+                   const std::string& _lastModified, const std::vector<char>& _content);
+
+    void loadIndex();
+    void touch(uint64_t _key, Entry& _entry, int64_t _now);
+    void remove(uint64_t _key);
+    // Evict entries until the budget is met, returns the keys to unlink
+    std::vector<uint64_t> evict();
+    void unlinkBlobs(const std::vector<uint64_t>& _keys);
+
+    const std::string m_path;
+    const uint64_t m_maxBytes;
+    bool m_valid = false;
+
+    std::mutex m_mutex;
+    std::unordered_map<uint64_t, Entry> m_entries;
+    // Most recently used first
+    std::list<uint64_t> m_lru;
+    uint64_t m_totalBytes = 0;
+    uint32_t m_unflushed = 0;
+    Stats m_stats;
+
+    std::mutex m_flushMutex;
+};
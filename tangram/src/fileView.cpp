@@ -0,0 +1,89 @@
+#include "fileView.h"
+
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Files below this size are read, a mapping costs a few page faults and
+// a VMA that outweigh the copy
+#define MMAP_THRESHOLD (64 * 1024)
+
+int openFile(const char* _path, size_t& _size, bool _sequential) {
+    int fd = ::open(_path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) { return -1; }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return -1;
+    }
+    _size = st.st_size;
+
+#ifdef POSIX_FADV_SEQUENTIAL
+    if (_sequential) {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+#endif
+    return fd;
+}
+
+bool readFully(int _fd, char* _data, size_t _size) {
+    while (_size > 0) {
+        ssize_t n = read(_fd, _data, _size);
+        if (n < 0 && errno == EINTR) { continue; }
+        if (n <= 0) { return false; }
+        _data += n;
+        _size -= n;
+    }
+    return true;
+}
+
+bool readFile(const std::string& _path, std::vector<char>& _content) {
+    size_t size = 0;
+    int fd = openFile(_path.c_str(), size, true);
+    if (fd < 0) { return false; }
+
+    _content.resize(size);
+    bool ok = readFully(fd, _content.data(), size);
+    close(fd);
+
+    if (!ok) { _content.clear(); }
+    return ok;
+}
+
+std::shared_ptr<FileView> FileView::open(const std::string& _path) {
+    size_t size = 0;
+    int fd = openFile(_path.c_str(), size);
+    if (fd < 0) { return nullptr; }
+
+    std::shared_ptr<FileView> view(new FileView());
+    view->m_size = size;
+
+    if (size >= MMAP_THRESHOLD) {
+        void* map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            view->m_data = static_cast<const char*>(map);
+            view->m_mapped = true;
+            close(fd);
+            return view;
+        }
+    }
+
+    // Small file, or mmap not possible on this file system
+    view->m_buffer.resize(size);
+    bool ok = readFully(fd, view->m_buffer.data(), size);
+    close(fd);
+
+    if (!ok) { return nullptr; }
+
+    view->m_data = view->m_buffer.data();
+    return view;
+}
+
+FileView::~FileView() {
+    if (m_mapped) {
+        munmap(const_cast<char*>(m_data), m_size);
+    }
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Read-only view of the whole content of a file. Large files are mapped and
+// paged in by the kernel as they are touched, small ones are read into
+// memory where a mapping would cost more than it saves. A view is shared
+// through shared_ptr and the mapping lives as long as any holder. It saves
+// memory only where content is used in place, e.g. archive tiles; content
+// handed to tangram-es must be an owned copy, read it with readFile().
+class FileView {
+
+public:
+
+    // nullptr when _path cannot be read
+    static std::shared_ptr<FileView> open(const std::string& _path);
+
+    ~FileView();
+
+    FileView(const FileView&) = delete;
+    FileView& operator=(const FileView&) = delete;
+
+    const char* data() const { return m_data; }
+    size_t size() const { return m_size; }
+    bool isMapped() const { return m_mapped; }
+
+private:
+
+    FileView() = default;
+
+    const char* m_data = nullptr;
+    size_t m_size = 0;
+    bool m_mapped = false;
+    // Content of small files
+    std::vector<char> m_buffer;
+};
+
+// Open _path for reading and get its size, returns -1 on failure. Files
+// read front to back in one go are opened _sequential, for a longer
+// read-ahead; mapped files are read at random offsets and are not
+int openFile(const char* _path, size_t& _size, bool _sequential = false);
+
+// Read exactly _size bytes from _fd, retrying short reads
+bool readFully(int _fd, char* _data, size_t _size);
+
+// Read the whole of _path into _content
+bool readFile(const std::string& _path, std::vector<char>& _content);
@@ -0,0 +1,171 @@
+#include "fontCache.h"
+#include "log.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <sstream>
+#include <vector>
+
+#include <sys/stat.h>
+
+#define INDEX_HEADER "tangram-fonts 1"
+
+static std::string fontKey(const std::string& _name, const std::string& _weight, const std::string& _face) {
+    return _name + '\t' + _weight + '\t' + _face;
+}
+
+FontCache::FontCache(Resolver _resolver) : m_resolver(_resolver) {}
+
+FontCache::~FontCache() {
+    flush();
+}
+
+void FontCache::persist(const std::string& _path, uint64_t _signature) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    m_indexPath = _path;
+    m_signature = _signature;
+    m_dirty = false;
+
+    if (!m_indexPath.empty()) { load(); }
+}
+
+std::string FontCache::path(const std::string& _name, const std::string& _weight, const std::string& _face) {
+    return lookup(fontKey(_name, _weight, _face), [&]() { return m_resolver(_name, _weight, _face); });
+}
+
+std::string FontCache::lookup(const std::string& _key, const std::function<std::string()>& _resolve) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_paths.find(_key);
+        if (it != m_paths.end()) { return it->second; }
+    }
+
+    // Misses are remembered as well, most scenes ask for fonts the system
+    // does not have
+    std::string path = _resolve();
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_paths[_key] = path;
+    m_dirty = !m_indexPath.empty();
+
+    return path;
+}
+
+bool FontCache::isDirty() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_dirty;
+}
+
+void FontCache::flush() {
+    std::lock_guard<std::mutex> saveLock(m_saveMutex);
+
+    std::string path;
+    uint64_t signature;
+    std::unordered_map<std::string, std::string> paths;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_dirty) { return; }
+
+        path = m_indexPath;
+        signature = m_signature;
+        paths = m_paths;
+        m_dirty = false;
+    }
+
+    if (!save(path, signature, paths)) {
+        // Not retried, e.g. on a read-only file system
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_indexPath == path) { m_indexPath.clear(); }
+    }
+}
+
+std::shared_ptr<FileView> FontCache::file(const std::string& _path) {
+    struct stat st;
+    if (stat(_path.c_str(), &st) != 0) { return nullptr; }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    // Entries of files nobody holds anymore
+    for (auto it = m_files.begin(); it != m_files.end();) {
+        it = it->second.view.expired() ? m_files.erase(it) : std::next(it);
+    }
+
+    auto& blob = m_files[std::make_pair(st.st_dev, st.st_ino)];
+    auto view = blob.view.lock();
+    if (view && blob.mtime == int64_t(st.st_mtime) && blob.size == int64_t(st.st_size)) {
+        return view;
+    }
+
+    view = FileView::open(_path);
+    if (!view) {
+        m_files.erase(std::make_pair(st.st_dev, st.st_ino));
+        return nullptr;
+    }
+    blob.view = view;
+    blob.mtime = st.st_mtime;
+    blob.size = st.st_size;
+    return view;
+}
+
+void FontCache::load() {
+    FILE* file = fopen(m_indexPath.c_str(), "r");
+    if (!file) { return; }
+
+    std::string content;
+    char buffer[4096];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        content.append(buffer, n);
+    }
+    fclose(file);
+
+    std::istringstream lines(content);
+    std::string line;
+
+    // Written under another fontconfig setup, the matches may be stale
+    char signature[32];
+    snprintf(signature, sizeof(signature), " %016llx", (unsigned long long)m_signature);
+    if (!std::getline(lines, line) || line != std::string(INDEX_HEADER) + signature) {
+        return;
+    }
+
+    size_t count = 0;
+    while (std::getline(lines, line)) {
+        // name, weight, face and path separated by tabs
+        size_t last = line.rfind('\t');
+        if (last == std::string::npos) { continue; }
+
+        m_paths.emplace(line.substr(0, last), line.substr(last + 1));
+        count++;
+    }
+    LOG("Loaded %zu font matches from %s", count, m_indexPath.c_str());
+}
+
+bool FontCache::save(const std::string& _path, uint64_t _signature,
+                     const std::unordered_map<std::string, std::string>& _paths) {
+    std::string tmpPath = _path + ".tmp";
+
+    FILE* file = fopen(tmpPath.c_str(), "w");
+    if (!file) {
+        LOGW("Cannot write font index %s", tmpPath.c_str());
+        return false;
+    }
+
+    fprintf(file, "%s %016llx\n", INDEX_HEADER, (unsigned long long)_signature);
+    for (auto& entry : _paths) {
+        if (entry.second.find_first_of("\t\n") != std::string::npos ||
+            entry.first.find('\n') != std::string::npos ||
+            std::count(entry.first.begin(), entry.first.end(), '\t') != 2) {
+            continue;
+        }
+        fprintf(file, "%s\t%s\n", entry.first.c_str(), entry.second.c_str());
+    }
+
+    if (fclose(file) != 0 || rename(tmpPath.c_str(), _path.c_str()) != 0) {
+        LOGW("Cannot write font index %s", _path.c_str());
+        remove(tmpPath.c_str());
+        return false;
+    }
+    return true;
+}
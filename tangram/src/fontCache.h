@@ -0,0 +1,81 @@
+#pragma once
+
+#include "fileView.h"
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+#include <sys/types.h>
+
+// Remembers which font file matches a (name, weight, face) request, so a
+// scene load after the first one does not query fontconfig again, and shares
+// a font file among the loads running at the same time. The matches can be persisted
+// to a small index file, reused by later runs as long as the fontconfig
+// setup it was written under is unchanged.
+class FontCache {
+
+public:
+
+    // Match a font request to a file, "" when nothing fits
+    using Resolver = std::function<std::string(const std::string& _name, const std::string& _weight,
+                                               const std::string& _face)>;
+
+    explicit FontCache(Resolver _resolver);
+    // Writes matches not yet saved
+    ~FontCache();
+
+    // Load the index at _path when it was written under _signature and save
+    // new matches to it with flush(), "" stops persisting
+    void persist(const std::string& _path, uint64_t _signature);
+
+    // Whether matches were made since the index was last written
+    bool isDirty();
+    // Write the index if isDirty(), e.g. once a scene is loaded
+    void flush();
+
+    std::string path(const std::string& _name, const std::string& _weight, const std::string& _face);
+
+    // Like path() for matches made by _resolve, e.g. the fallback font of a
+    // language. _key is three fields separated by '\t'
+    std::string lookup(const std::string& _key, const std::function<std::string()>& _resolve);
+
+    // Content of the font file at _path, shared by every path naming the
+    // same file (links, fallbacks of several languages) while any caller
+    // holds it. Callers copy the content and let go: the text engine keeps
+    // its own buffer, a mapping kept beside it would count twice. A file
+    // replaced on disk is opened again
+    std::shared_ptr<FileView> file(const std::string& _path);
+
+private:
+
+    void load();
+    bool save(const std::string& _path, uint64_t _signature,
+              const std::unordered_map<std::string, std::string>& _paths);
+
+    const Resolver m_resolver;
+
+    std::mutex m_mutex;
+    // Three fields separated by '\t', e.g. name, weight and face
+    std::unordered_map<std::string, std::string> m_paths;
+
+    struct Blob {
+        int64_t mtime;
+        int64_t size;
+        std::weak_ptr<FileView> view;
+    };
+    // Font files in use by device and inode
+    std::map<std::pair<dev_t, ino_t>, Blob> m_files;
+
+    std::string m_indexPath;
+    uint64_t m_signature = 0;
+    bool m_dirty = false;
+
+    // Held while the index is written, without blocking lookups
+    std::mutex m_saveMutex;
+};
@@ -0,0 +1,51 @@
+#include "framePacer.h"
+
+#include <thread>
+
+// Wake-up slack of a sleeping thread, spun through by HYBRID
+#define SPIN_MARGIN std::chrono::microseconds(1500)
+
+void FramePacer::setTargetFps(double _fps) {
+    m_fps = _fps > 0.0 ? _fps : 0.0;
+    m_interval = m_fps > 0.0
+        ? std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / m_fps))
+        : Clock::duration::zero();
+    m_deadline = Clock::now();
+}
+
+void FramePacer::wait() {
+    if (m_fps > 0.0 && m_started) {
+        if (m_strategy != SPIN) {
+            Clock::time_point wake = m_deadline;
+            if (m_strategy == HYBRID) { wake -= SPIN_MARGIN; }
+            if (wake > Clock::now()) {
+                std::this_thread::sleep_until(wake);
+            }
+        }
+        if (m_strategy != SLEEP) {
+            while (Clock::now() < m_deadline) {}
+        }
+    }
+
+    m_started = true;
+}
+
+void FramePacer::frameDone() {
+    if (m_fps <= 0.0) { return; }
+
+    m_deadline += m_interval;
+
+    // More than a frame late, keeping the schedule would burst frames out
+    Clock::time_point now = Clock::now();
+    if (m_deadline + m_interval < now) {
+        m_deadline = now;
+    }
+}
+
+double FramePacer::timeLeft() const {
+    if (m_fps <= 0.0) { return 0.0; }
+
+    Clock::time_point now = Clock::now();
+    if (m_deadline <= now) { return 0.0; }
+    return std::chrono::duration<double>(m_deadline - now).count();
+}
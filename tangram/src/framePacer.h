@@ -0,0 +1,45 @@
+#pragma once
+
+#include <chrono>
+
+// Spaces frames at a target rate on the monotonic clock. wait() holds the
+// next frame back until its start time; until then the rest of the frame
+// budget is free for other work, see timeLeft(). A frame that runs late
+// starts the schedule over instead of rushing the following ones.
+class FramePacer {
+
+public:
+
+    using Clock = std::chrono::steady_clock;
+
+    enum Strategy {
+        SLEEP,  // lets the CPU idle, wakes up with the scheduler's slack
+        SPIN,   // busy waits, exact but burns a core
+        HYBRID  // sleeps, then spins the last stretch
+    };
+
+    // 0 renders as fast as possible
+    void setTargetFps(double _fps);
+    double targetFps() const { return m_fps; }
+
+    void setStrategy(Strategy _strategy) { m_strategy = _strategy; }
+    Strategy strategy() const { return m_strategy; }
+
+    // Block until the next frame is due
+    void wait();
+    // A frame was presented, the next one is due one interval after this one
+    // was due: waking up late shortens the next wait instead of adding up
+    void frameDone();
+
+    // Seconds left until the next frame is due, 0 when it is already
+    double timeLeft() const;
+
+private:
+
+    double m_fps = 0.0;
+    Strategy m_strategy = HYBRID;
+    Clock::duration m_interval = Clock::duration::zero();
+
+    Clock::time_point m_deadline;
+    bool m_started = false;
+};
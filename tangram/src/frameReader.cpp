@@ -0,0 +1,178 @@
+#include "frameReader.h"
+
+#include "platform_gl.h"
+#undef countof
+
+#include <algorithm>
+#include <cstring>
+
+// GLES2 has no pixel buffer objects
+#ifdef GL_PIXEL_PACK_BUFFER
+#define HAS_PIXEL_BUFFERS
+#endif
+
+// Frames kept for reuse besides the ones still held by callers
+#define MAX_POOLED_FRAMES 4
+
+// GL rows go bottom up
+static void copyFlipped(const uint8_t* _src, PixelFrame& _frame) {
+    const size_t stride = size_t(_frame.width) * 4;
+    for (int row = 0; row < _frame.height; row++) {
+        memcpy(_frame.pixels.data() + row * stride, _src + (_frame.height - 1 - row) * stride, stride);
+    }
+}
+
+FrameReader::FrameReader(uint32_t _buffers) : m_numBuffers(std::max(2u, _buffers)) {}
+
+void FrameReader::capture(uint64_t _index, int _width, int _height) {
+    if (_width <= 0 || _height <= 0) { return; }
+
+#ifdef HAS_PIXEL_BUFFERS
+    if (m_slots.empty()) {
+        m_slots.resize(m_numBuffers);
+        for (auto& slot : m_slots) {
+            glGenBuffers(1, &slot.buffer);
+        }
+    }
+
+    Slot& slot = m_slots[m_next];
+    m_next = (m_next + 1) % m_slots.size();
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+
+    size_t size = size_t(_width) * _height * 4;
+    if (slot.capacity != size) {
+        glBufferData(GL_PIXEL_PACK_BUFFER, size, nullptr, GL_STREAM_READ);
+        slot.capacity = size;
+    }
+
+    // Returns at once, the copy lands in the buffer asynchronously
+    glReadPixels(0, 0, _width, _height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    slot.index = _index;
+    slot.width = _width;
+    slot.height = _height;
+    slot.pending = true;
+#else
+    m_last = std::const_pointer_cast<PixelFrame>(readNow(_index, _width, _height));
+#endif
+}
+
+std::shared_ptr<const PixelFrame> FrameReader::read() {
+#ifdef HAS_PIXEL_BUFFERS
+    // The frame before the newest one, its copy overlapped the rendering of
+    // the newest. Right after the first capture that one has to do
+    Slot* newest = nullptr;
+    Slot* previous = nullptr;
+    for (auto& slot : m_slots) {
+        if (!slot.pending) { continue; }
+        if (!newest || slot.index > newest->index) {
+            previous = newest;
+            newest = &slot;
+        } else if (!previous || slot.index > previous->index) {
+            previous = &slot;
+        }
+    }
+
+    Slot* slot = previous ? previous : newest;
+    if (!slot) { return m_last; }
+    if (m_last && m_last->index == slot->index) { return m_last; }
+
+    map(*slot);
+#endif
+    return m_last;
+}
+
+std::shared_ptr<const PixelFrame> FrameReader::read(uint64_t _index) {
+    if (m_last && m_last->index == _index) { return m_last; }
+
+#ifdef HAS_PIXEL_BUFFERS
+    for (auto& slot : m_slots) {
+        if (slot.pending && slot.index == _index) {
+            map(slot);
+            if (m_last && m_last->index == _index) { return m_last; }
+        }
+    }
+#endif
+    return nullptr;
+}
+
+bool FrameReader::isAsync() const {
+#ifdef HAS_PIXEL_BUFFERS
+    return true;
+#else
+    return false;
+#endif
+}
+
+void FrameReader::map(Slot& _slot) {
+#ifdef HAS_PIXEL_BUFFERS
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, _slot.buffer);
+
+    auto data = static_cast<const uint8_t*>(glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY));
+    if (data) {
+        auto frame = acquire(_slot.index, _slot.width, _slot.height);
+        copyFlipped(data, *frame);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        m_last = frame;
+    }
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+#endif
+}
+
+std::shared_ptr<const PixelFrame> FrameReader::readNow(uint64_t _index, int _width, int _height) {
+    if (_width <= 0 || _height <= 0) { return nullptr; }
+
+    auto frame = acquire(_index, _width, _height);
+
+    // Read into the frame and flip in place, sparing a second buffer
+    glReadPixels(0, 0, _width, _height, GL_RGBA, GL_UNSIGNED_BYTE, frame->pixels.data());
+
+    const size_t stride = size_t(_width) * 4;
+    std::vector<uint8_t> row(stride);
+    for (int top = 0, bottom = _height - 1; top < bottom; top++, bottom--) {
+        uint8_t* a = frame->pixels.data() + top * stride;
+        uint8_t* b = frame->pixels.data() + bottom * stride;
+        memcpy(row.data(), a, stride);
+        memcpy(a, b, stride);
+        memcpy(b, row.data(), stride);
+    }
+
+    return frame;
+}
+
+void FrameReader::release() {
+#ifdef HAS_PIXEL_BUFFERS
+    for (auto& slot : m_slots) {
+        glDeleteBuffers(1, &slot.buffer);
+    }
+#endif
+    m_slots.clear();
+    m_next = 0;
+    m_last.reset();
+}
+
+std::shared_ptr<PixelFrame> FrameReader::acquire(uint64_t _index, int _width, int _height) {
+    std::shared_ptr<PixelFrame> frame;
+
+    // Only the pool holds it, nobody sees the pixels change
+    for (auto& pooled : m_pool) {
+        if (pooled.use_count() == 1) {
+            frame = pooled;
+            break;
+        }
+    }
+
+    if (!frame) {
+        frame = std::make_shared<PixelFrame>();
+        if (m_pool.size() < MAX_POOLED_FRAMES) { m_pool.push_back(frame); }
+    }
+
+    frame->index = _index;
+    frame->width = _width;
+    frame->height = _height;
+    frame->pixels.resize(size_t(_width) * _height * 4);
+    return frame;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// RGBA pixels of a rendered frame, top row first
+struct PixelFrame {
+    uint64_t index = 0;     // update() that rendered it
+    int width = 0;
+    int height = 0;
+    std::vector<uint8_t> pixels;
+};
+
+// Reads rendered frames back from the GL framebuffer. Captured frames go
+// through a ring of pixel buffer objects: the copy of frame N runs on the
+// GPU while frame N+1 renders, and is mapped only once finished. GLES2 (the
+// RPi) has no pixel buffers, there frames are read synchronously.
+//
+// Frames are recycled once nobody holds them anymore. All calls belong on
+// the GL thread.
+class FrameReader {
+
+public:
+
+    explicit FrameReader(uint32_t _buffers = 3);
+
+    // Queue the readback of the frame just rendered, before buffers swap
+    void capture(uint64_t _index, int _width, int _height);
+
+    // Latest captured frame whose readback had a frame of time to finish,
+    // nullptr before the first capture
+    std::shared_ptr<const PixelFrame> read();
+
+    // The captured frame _index while it is still in the ring, nullptr
+    // otherwise
+    std::shared_ptr<const PixelFrame> read(uint64_t _index);
+
+    // Whether capture() returns before the copy is done, false on GLES2
+    bool isAsync() const;
+
+    // Read the bound framebuffer now, stalling until rendering is done
+    std::shared_ptr<const PixelFrame> readNow(uint64_t _index, int _width, int _height);
+
+    // Delete the pixel buffers, while the GL context is still current
+    void release();
+
+private:
+
+    struct Slot {
+        uint32_t buffer = 0;
+        size_t capacity = 0;
+        uint64_t index = 0;
+        int width = 0;
+        int height = 0;
+        bool pending = false;
+    };
+
+    std::shared_ptr<PixelFrame> acquire(uint64_t _index, int _width, int _height);
+    void map(Slot& _slot);
+
+    const uint32_t m_numBuffers;
+    std::vector<Slot> m_slots;
+    size_t m_next = 0;
+
+    std::shared_ptr<PixelFrame> m_last;
+    std::vector<std::shared_ptr<PixelFrame>> m_pool;
+};
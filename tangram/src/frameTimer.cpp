@@ -0,0 +1,49 @@
+#include "frameTimer.h"
+
+#include <algorithm>
+#include <cmath>
+
+constexpr size_t FrameTimer::NUM_SAMPLES;
+
+void FrameTimer::record(Phase _phase, Clock::duration _duration) {
+    Ring& ring = m_rings[_phase];
+    ring.samples[ring.next] = std::chrono::duration<float, std::micro>(_duration).count();
+    ring.next = (ring.next + 1) % NUM_SAMPLES;
+    ring.count = std::min(ring.count + 1, NUM_SAMPLES);
+}
+
+Histogram::Summary FrameTimer::summary(Phase _phase) const {
+    Histogram::Summary summary;
+    if (_phase < 0 || _phase >= NUM_PHASES) { return summary; }
+
+    const Ring& ring = m_rings[_phase];
+    if (ring.count == 0) { return summary; }
+
+    // Order does not matter once the ring is sorted
+    std::copy(ring.samples, ring.samples + ring.count, m_sorted);
+    std::sort(m_sorted, m_sorted + ring.count);
+
+    double sum = 0;
+    for (size_t i = 0; i < ring.count; i++) { sum += m_sorted[i]; }
+
+    // Nearest rank
+    auto percentile = [&](double _p) {
+        size_t rank = size_t(std::ceil(_p * ring.count));
+        return m_sorted[std::min(ring.count, std::max<size_t>(rank, 1)) - 1];
+    };
+
+    summary.count = ring.count;
+    summary.mean = sum / ring.count;
+    summary.p50 = percentile(0.50);
+    summary.p95 = percentile(0.95);
+    summary.p99 = percentile(0.99);
+    summary.max = m_sorted[ring.count - 1];
+    return summary;
+}
+
+void FrameTimer::reset() {
+    for (auto& ring : m_rings) {
+        ring.next = 0;
+        ring.count = 0;
+    }
+}
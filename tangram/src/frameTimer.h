@@ -0,0 +1,47 @@
+#pragma once
+
+#include "histogram.h"
+
+#include <chrono>
+#include <cstddef>
+
+// Durations of the phases of the last frames, kept in fixed rings so that
+// recording and summaries never allocate. Not thread safe: a map records
+// and is queried on its own thread.
+class FrameTimer {
+
+public:
+
+    using Clock = std::chrono::steady_clock;
+
+    enum Phase {
+        NETWORK,    // dispatching the priority view to the URL queue
+        EVENTS,     // polling input
+        UPDATE,     // Map::update(), tile and label updates
+        RENDER,     // Map::render() and frame capture
+        SWAP,       // presenting the frame
+        FRAME,      // all of the above, without pacing or idle waits
+        NUM_PHASES
+    };
+
+    // Frames summarized per phase
+    static constexpr size_t NUM_SAMPLES = 512;
+
+    void record(Phase _phase, Clock::duration _duration);
+
+    // In microseconds over the last NUM_SAMPLES frames
+    Histogram::Summary summary(Phase _phase) const;
+
+    void reset();
+
+private:
+
+    struct Ring {
+        float samples[NUM_SAMPLES];
+        size_t next = 0;
+        size_t count = 0;
+    };
+
+    Ring m_rings[NUM_PHASES];
+    mutable float m_sorted[NUM_SAMPLES];
+};
@@ -0,0 +1,69 @@
+#include "histogram.h"
+
+#include <algorithm>
+
+constexpr int Histogram::NUM_BUCKETS;
+
+static int bucketOf(uint64_t _value) {
+    int bucket = 0;
+    while (_value) {
+        bucket++;
+        _value >>= 1;
+    }
+    return bucket;
+}
+
+Histogram::Histogram() {
+    for (auto& bucket : m_buckets) {
+        bucket.store(0, std::memory_order_relaxed);
+    }
+}
+
+void Histogram::record(uint64_t _value) {
+    m_buckets[bucketOf(_value)].fetch_add(1, std::memory_order_relaxed);
+    m_sum.fetch_add(_value, std::memory_order_relaxed);
+
+    uint64_t max = m_max.load(std::memory_order_relaxed);
+    while (_value > max && !m_max.compare_exchange_weak(max, _value, std::memory_order_relaxed)) {}
+}
+
+Histogram::Summary Histogram::summary() const {
+    uint64_t buckets[NUM_BUCKETS];
+    uint64_t count = 0;
+    for (int i = 0; i < NUM_BUCKETS; i++) {
+        buckets[i] = m_buckets[i].load(std::memory_order_relaxed);
+        count += buckets[i];
+    }
+
+    Summary summary;
+    if (count == 0) { return summary; }
+
+    uint64_t max = m_max.load(std::memory_order_relaxed);
+
+    summary.count = count;
+    summary.mean = double(m_sum.load(std::memory_order_relaxed)) / count;
+    summary.p50 = percentile(buckets, count, max, 0.50);
+    summary.p95 = percentile(buckets, count, max, 0.95);
+    summary.p99 = percentile(buckets, count, max, 0.99);
+    summary.max = max;
+    return summary;
+}
+
+double Histogram::percentile(const uint64_t* _buckets, uint64_t _count, uint64_t _max, double _p) const {
+    double target = _p * _count;
+    double seen = 0;
+
+    for (int i = 0; i < NUM_BUCKETS; i++) {
+        if (_buckets[i] == 0) { continue; }
+
+        if (seen + _buckets[i] >= target) {
+            if (i == 0) { return 0; }
+
+            double low = double(uint64_t(1) << (i - 1));
+            double high = std::min(low * 2, double(_max));
+            return low + (high - low) * (target - seen) / _buckets[i];
+        }
+        seen += _buckets[i];
+    }
+    return _max;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// Distribution of unsigned values in power of two buckets. Recording is a
+// few relaxed atomic operations, so any thread can record without locking;
+// percentiles are interpolated within their bucket.
+class Histogram {
+
+public:
+
+    struct Summary {
+        uint64_t count = 0;
+        double mean = 0;
+        double p50 = 0;
+        double p95 = 0;
+        double p99 = 0;
+        double max = 0;
+    };
+
+    Histogram();
+
+    void record(uint64_t _value);
+
+    // Concurrent records may or may not be part of the summary
+    Summary summary() const;
+
+private:
+
+    // Bucket 0 holds 0, bucket i holds [2^(i-1), 2^i)
+    static constexpr int NUM_BUCKETS = 65;
+
+    double percentile(const uint64_t* _buckets, uint64_t _count, uint64_t _max, double _p) const;
+
+    // Their sum is the count, consistent with the percentiles
+    std::atomic<uint64_t> m_buckets[NUM_BUCKETS];
+    std::atomic<uint64_t> m_sum{0};
+    std::atomic<uint64_t> m_max{0};
+};
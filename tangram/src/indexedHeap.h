@@ -0,0 +1,158 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Binary min-heap of keys ordered by a priority that can be changed after
+// insertion. The heap position of every key is tracked, so update() and
+// remove() run in O(log n). Keys of equal priority come out in insertion order.
+template <typename Key, typename Priority, typename Hash = std::hash<Key>>
+class IndexedHeap {
+
+public:
+
+    bool empty() const { return m_nodes.empty(); }
+    size_t size() const { return m_nodes.size(); }
+
+    bool contains(const Key& _key) const { return m_index.count(_key) != 0; }
+
+    const Key& top() const { return m_nodes.front().key; }
+    Priority topPriority() const { return m_nodes.front().priority; }
+    uint64_t topSequence() const { return m_nodes.front().sequence; }
+
+    // Insert _key, or change its priority when already present
+    void push(const Key& _key, Priority _priority) {
+        if (update(_key, _priority)) { return; }
+
+        m_nodes.push_back({ _key, _priority, m_sequence++ });
+        m_index[_key] = m_nodes.size() - 1;
+        siftUp(m_nodes.size() - 1);
+    }
+
+    // Insert _key with the insertion order it had in another heap, handed
+    // over from its topSequence(), so it keeps its place among equal
+    // priorities when moved between heaps numbered by the same one
+    void push(const Key& _key, Priority _priority, uint64_t _sequence) {
+        if (update(_key, _priority)) { return; }
+
+        m_nodes.push_back({ _key, _priority, _sequence });
+        m_index[_key] = m_nodes.size() - 1;
+        m_sequence = std::max(m_sequence, _sequence + 1);
+        siftUp(m_nodes.size() - 1);
+    }
+
+    bool update(const Key& _key, Priority _priority) {
+        auto it = m_index.find(_key);
+        if (it == m_index.end()) { return false; }
+
+        size_t pos = it->second;
+        Priority old = m_nodes[pos].priority;
+        m_nodes[pos].priority = _priority;
+
+        if (_priority < old) {
+            siftUp(pos);
+        } else {
+            siftDown(pos);
+        }
+        return true;
+    }
+
+    bool priority(const Key& _key, Priority& _priority) const {
+        auto it = m_index.find(_key);
+        if (it == m_index.end()) { return false; }
+
+        _priority = m_nodes[it->second].priority;
+        return true;
+    }
+
+    void pop() { removeAt(0); }
+
+    bool remove(const Key& _key) {
+        auto it = m_index.find(_key);
+        if (it == m_index.end()) { return false; }
+
+        removeAt(it->second);
+        return true;
+    }
+
+    void clear() {
+        m_nodes.clear();
+        m_index.clear();
+    }
+
+    // Visit all keys in heap order (not sorted)
+    template <typename F>
+    void forEach(F _fn) const {
+        for (auto& node : m_nodes) { _fn(node.key, node.priority); }
+    }
+
+private:
+
+    struct Node {
+        Key key;
+        Priority priority;
+        uint64_t sequence;
+    };
+
+    bool less(size_t _a, size_t _b) const {
+        const Node& a = m_nodes[_a];
+        const Node& b = m_nodes[_b];
+        if (a.priority < b.priority) { return true; }
+        if (b.priority < a.priority) { return false; }
+        return a.sequence < b.sequence;
+    }
+
+    void swapNodes(size_t _a, size_t _b) {
+        std::swap(m_nodes[_a], m_nodes[_b]);
+        m_index[m_nodes[_a].key] = _a;
+        m_index[m_nodes[_b].key] = _b;
+    }
+
+    void siftUp(size_t _pos) {
+        while (_pos > 0) {
+            size_t parent = (_pos - 1) / 2;
+            if (!less(_pos, parent)) { break; }
+            swapNodes(_pos, parent);
+            _pos = parent;
+        }
+    }
+
+    void siftDown(size_t _pos) {
+        const size_t n = m_nodes.size();
+        while (true) {
+            size_t left = 2 * _pos + 1;
+            size_t right = left + 1;
+            size_t smallest = _pos;
+
+            if (left < n && less(left, smallest)) { smallest = left; }
+            if (right < n && less(right, smallest)) { smallest = right; }
+            if (smallest == _pos) { break; }
+
+            swapNodes(_pos, smallest);
+            _pos = smallest;
+        }
+    }
+
+    void removeAt(size_t _pos) {
+        size_t last = m_nodes.size() - 1;
+        if (_pos != last) {
+            swapNodes(_pos, last);
+        }
+        m_index.erase(m_nodes.back().key);
+        m_nodes.pop_back();
+
+        if (_pos < m_nodes.size()) {
+            siftDown(_pos);
+            siftUp(_pos);
+        }
+    }
+
+    std::vector<Node> m_nodes;
+    std::unordered_map<Key, size_t, Hash> m_index;
+    uint64_t m_sequence = 0;
+};
@@ -0,0 +1,277 @@
+#include "logger.h"
+#include "trace.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <thread>
+
+// Messages waiting for the logging thread, a power of two
+#define LOG_SLOTS 1024
+// Longer messages are truncated
+#define LOG_LINE 512
+// Format strings rate limited separately, others are not limited
+#define LOG_SITES 256
+// Messages per format string and second
+#define LOG_BURST 20
+// Upper bound for the logging thread to notice a message
+#define LOG_WAIT std::chrono::milliseconds(100)
+
+using Clock = std::chrono::steady_clock;
+
+struct LogSlot {
+    // Bounded MPMC queue of D. Vyukov, here with a single consumer: equals
+    // the position when free, the position + 1 when written
+    std::atomic<size_t> sequence;
+    LogLevel level;
+    uint32_t suppressed;    // messages of the same site held back before
+    char text[LOG_LINE];
+};
+
+struct LogSite {
+    std::atomic<const char*> fmt{nullptr};
+    std::atomic<int64_t> windowStart{0};
+    std::atomic<uint32_t> count{0};
+    std::atomic<uint32_t> suppressed{0};
+};
+
+struct Logger {
+    LogSlot slots[LOG_SLOTS];
+    LogSite sites[LOG_SITES];
+
+    std::atomic<size_t> tail{0};    // next position to write
+    std::atomic<size_t> head{0};    // next position to read, by the thread only
+    std::atomic<uint64_t> dropped{0};
+    std::atomic<int> level{LOG_LEVEL_DEBUG};
+    std::atomic<bool> stopped{false};
+
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::condition_variable drained;
+    bool stopping = false;
+
+    // Held while the sink runs
+    std::mutex sinkMutex;
+    LogSink sink;
+
+    std::thread thread;
+
+    Logger() {
+        for (size_t i = 0; i < LOG_SLOTS; i++) {
+            slots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+};
+
+static void drain(Logger* _log);
+static void stopLogger();
+
+// Never destroyed, messages may come from static destructors
+static Logger* logger() {
+    static Logger* s_logger = []() {
+        Logger* created = new Logger();
+        created->thread = std::thread(drain, created);
+        std::atexit(stopLogger);
+        return created;
+    }();
+    return s_logger;
+}
+
+static LogLevel levelOf(const char* _fmt) {
+    if (strncmp(_fmt, "ERROR", 5) == 0) { return LOG_LEVEL_ERROR; }
+    if (strncmp(_fmt, "WARNING", 7) == 0) { return LOG_LEVEL_WARNING; }
+    if (strncmp(_fmt, "NOTIFY", 6) == 0) { return LOG_LEVEL_NOTIFY; }
+    if (strncmp(_fmt, "DEBUG", 5) == 0) { return LOG_LEVEL_DEBUG; }
+    return LOG_LEVEL_INFO;
+}
+
+// Site of a format string, claimed on first use; nullptr once all are taken
+static LogSite* siteOf(Logger& _logger, const char* _fmt) {
+    size_t hash = (uintptr_t(_fmt) >> 3) * 0x9E3779B97F4A7C15ull;
+    for (size_t i = 0; i < LOG_SITES; i++) {
+        LogSite& site = _logger.sites[(hash + i) % LOG_SITES];
+        const char* fmt = site.fmt.load(std::memory_order_acquire);
+        if (fmt == _fmt) { return &site; }
+        if (!fmt && (site.fmt.compare_exchange_strong(fmt, _fmt) || fmt == _fmt)) {
+            return &site;
+        }
+    }
+    return nullptr;
+}
+
+// Whether a message of _site goes out now. Counting is approximate under
+// contention, which only moves the limit by a message or two
+static bool admit(LogSite& _site, uint32_t& _suppressed) {
+    int64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now().time_since_epoch()).count();
+
+    int64_t start = _site.windowStart.load(std::memory_order_relaxed);
+    if (now - start >= 1000 && _site.windowStart.compare_exchange_strong(start, now)) {
+        _site.count.store(0, std::memory_order_relaxed);
+    }
+
+    if (_site.count.fetch_add(1, std::memory_order_relaxed) < LOG_BURST) {
+        _suppressed = _site.suppressed.exchange(0, std::memory_order_relaxed);
+        return true;
+    }
+    _site.suppressed.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+void logMessage(const char* _fmt, va_list _args) {
+    LogLevel level = levelOf(_fmt);
+    Logger& log = *logger();
+
+    if (level < log.level.load(std::memory_order_relaxed)) { return; }
+
+    // The logging thread is gone at exit
+    if (log.stopped.load()) {
+        vfprintf(stderr, _fmt, _args);
+        return;
+    }
+
+    uint32_t suppressed = 0;
+    LogSite* site = siteOf(log, _fmt);
+    if (site && !admit(*site, suppressed)) { return; }
+
+    size_t position = log.tail.load(std::memory_order_relaxed);
+    LogSlot* slot;
+    while (true) {
+        slot = &log.slots[position % LOG_SLOTS];
+        size_t sequence = slot->sequence.load(std::memory_order_acquire);
+        intptr_t diff = intptr_t(sequence) - intptr_t(position);
+
+        if (diff == 0) {
+            if (log.tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) { break; }
+        } else if (diff < 0) {
+            // Full, the logging thread is behind
+            log.dropped.fetch_add(1, std::memory_order_relaxed);
+            if (site) { site->suppressed.fetch_add(suppressed, std::memory_order_relaxed); }
+            return;
+        } else {
+            position = log.tail.load(std::memory_order_relaxed);
+        }
+    }
+
+    vsnprintf(slot->text, LOG_LINE, _fmt, _args);
+    slot->level = level;
+    slot->suppressed = suppressed;
+    slot->sequence.store(position + 1, std::memory_order_release);
+
+    // Does not wait: at worst the thread notices on its next timeout
+    log.condition.notify_one();
+}
+
+static void write(Logger& _log, LogLevel _level, std::string& _message) {
+    while (!_message.empty() && _message.back() == '\n') { _message.pop_back(); }
+
+    std::lock_guard<std::mutex> lock(_log.sinkMutex);
+    if (_log.sink) {
+        _log.sink(_level, _message);
+    } else {
+        _message += '\n';
+        fputs(_message.c_str(), stderr);
+    }
+}
+
+// Write the next message if it is ready
+static bool drainOne(Logger& _log, std::string& _message) {
+    size_t position = _log.head.load(std::memory_order_relaxed);
+    LogSlot& slot = _log.slots[position % LOG_SLOTS];
+
+    if (slot.sequence.load(std::memory_order_acquire) != position + 1) { return false; }
+
+    _message.assign(slot.text);
+    LogLevel level = slot.level;
+    uint32_t suppressed = slot.suppressed;
+
+    // Free the slot before the possibly slow write
+    slot.sequence.store(position + LOG_SLOTS, std::memory_order_release);
+    _log.head.store(position + 1, std::memory_order_release);
+
+    if (suppressed > 0) {
+        while (!_message.empty() && _message.back() == '\n') { _message.pop_back(); }
+        _message += " [" + std::to_string(suppressed) + " similar messages suppressed]";
+    }
+    write(_log, level, _message);
+    return true;
+}
+
+static void drain(Logger* _log) {
+    Logger& log = *_log;
+    setTraceThreadName("log");
+    std::string message;
+
+    while (true) {
+        while (drainOne(log, message)) {}
+
+        // Report held back messages of sites that went quiet, by their format
+        int64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now().time_since_epoch()).count();
+        for (LogSite& site : log.sites) {
+            const char* fmt = site.fmt.load(std::memory_order_acquire);
+            if (!fmt || site.suppressed.load(std::memory_order_relaxed) == 0 ||
+                now - site.windowStart.load(std::memory_order_relaxed) < 1000) {
+                continue;
+            }
+            uint32_t suppressed = site.suppressed.exchange(0, std::memory_order_relaxed);
+            if (suppressed > 0) {
+                message = fmt;
+                while (!message.empty() && message.back() == '\n') { message.pop_back(); }
+                message += " [" + std::to_string(suppressed) + " similar messages suppressed]";
+                write(log, levelOf(fmt), message);
+            }
+        }
+
+        uint64_t dropped = log.dropped.exchange(0, std::memory_order_relaxed);
+        if (dropped > 0) {
+            message = "WARNING " + std::to_string(dropped) + " log messages dropped, logging fell behind";
+            write(log, LOG_LEVEL_WARNING, message);
+        }
+
+        std::unique_lock<std::mutex> lock(log.mutex);
+        log.drained.notify_all();
+        if (log.stopping) { break; }
+        log.condition.wait_for(lock, LOG_WAIT);
+    }
+}
+
+static void stopLogger() {
+    Logger& log = *logger();
+    {
+        std::lock_guard<std::mutex> lock(log.mutex);
+        log.stopping = true;
+    }
+    log.condition.notify_all();
+
+    // Writes what is queued first
+    if (log.thread.joinable()) { log.thread.join(); }
+    log.stopped.store(true);
+
+    // Messages queued while the thread was stopping
+    std::string message;
+    while (drainOne(log, message)) {}
+}
+
+void setLoggerLevel(LogLevel _level) {
+    logger()->level.store(_level, std::memory_order_relaxed);
+}
+
+void setLoggerSink(LogSink _sink) {
+    Logger& log = *logger();
+    std::lock_guard<std::mutex> lock(log.sinkMutex);
+    log.sink = std::move(_sink);
+}
+
+void flushLogger(double _timeout) {
+    Logger& log = *logger();
+    size_t target = log.tail.load();
+
+    std::unique_lock<std::mutex> lock(log.mutex);
+    log.condition.notify_one();
+    log.drained.wait_for(lock, std::chrono::duration<double>(_timeout), [&]() {
+        return log.stopping || log.head.load(std::memory_order_acquire) >= target;
+    });
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdarg>
+#include <functional>
+#include <string>
+
+// Backend of logMsg(). Messages are formatted by the calling thread into a
+// fixed ring of slots and written out by a background thread, so logging
+// never waits on stderr or on a sink: when the ring is full messages are
+// dropped and counted. Every format string (every LOG call site) may log
+// a burst of messages per second, the rest are counted and summarized.
+
+enum LogLevel {
+    LOG_LEVEL_DEBUG = 0,
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_NOTIFY,
+    LOG_LEVEL_WARNING,
+    LOG_LEVEL_ERROR
+};
+
+// Called on the logging thread with each message, without trailing newline
+using LogSink = std::function<void(LogLevel _level, const std::string& _message)>;
+
+void logMessage(const char* _fmt, va_list _args);
+
+// Messages below _level are discarded before formatting
+void setLoggerLevel(LogLevel _level);
+// nullptr writes to stderr, the default. Returns once the previous sink is
+// no longer called
+void setLoggerSink(LogSink _sink);
+// Wait until the messages logged so far are written, at most _timeout seconds
+void flushLogger(double _timeout = 1.0);
@@ -0,0 +1,72 @@
+#include "memoryCache.h"
+
+#include <iterator>
+
+// Responses larger than this share of the budget are not kept, so that a
+// single big file does not flush everything else
+#define MAX_ENTRY_FRACTION 4
+
+MemoryCache::MemoryCache(size_t _maxBytes) : m_maxBytes(_maxBytes) {}
+
+bool MemoryCache::get(const std::string& _url, int64_t _now, std::vector<char>& _content) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto it = m_index.find(_url);
+    if (it == m_index.end()) { return false; }
+
+    if (it->second->expires <= _now) {
+        erase(it->second);
+        return false;
+    }
+
+    m_entries.splice(m_entries.begin(), m_entries, it->second);
+    _content = it->second->content;
+    m_hits++;
+    return true;
+}
+
+void MemoryCache::put(const std::string& _url, const std::vector<char>& _content, int64_t _expires) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto it = m_index.find(_url);
+    if (it != m_index.end()) {
+        erase(it->second);
+    }
+
+    if (_content.empty() || _content.size() > m_maxBytes / MAX_ENTRY_FRACTION) { return; }
+
+    m_entries.push_front({ _url, _content, _expires });
+    m_index[_url] = m_entries.begin();
+    m_bytes += _content.size();
+
+    evict();
+}
+
+void MemoryCache::setMaxBytes(size_t _maxBytes) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    m_maxBytes = _maxBytes;
+    evict();
+}
+
+MemoryCache::Stats MemoryCache::stats() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    Stats stats;
+    stats.hits = m_hits;
+    stats.entries = m_entries.size();
+    stats.bytes = m_bytes;
+    return stats;
+}
+
+void MemoryCache::erase(EntryList::iterator _it) {
+    m_bytes -= _it->content.size();
+    m_index.erase(_it->url);
+    m_entries.erase(_it);
+}
+
+void MemoryCache::evict() {
+    while (m_bytes > m_maxBytes && !m_entries.empty()) {
+        erase(std::prev(m_entries.end()));
+    }
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Small byte-budgeted LRU of recent responses (scene files, imports,
+// textures, tiles) in front of the disk cache and the network
+class MemoryCache {
+
+public:
+
+    struct Stats {
+        uint64_t hits = 0;
+        uint64_t entries = 0;
+        uint64_t bytes = 0;
+    };
+
+    explicit MemoryCache(size_t _maxBytes);
+
+    // Copy the content for _url when it is cached and still fresh at _now
+    bool get(const std::string& _url, int64_t _now, std::vector<char>& _content);
+
+    void put(const std::string& _url, const std::vector<char>& _content, int64_t _expires);
+
+    void setMaxBytes(size_t _maxBytes);
+
+    Stats stats();
+
+private:
+
+    struct Entry {
+        std::string url;
+        std::vector<char> content;
+        int64_t expires;
+    };
+
+    using EntryList = std::list<Entry>;
+
+    void erase(EntryList::iterator _it);
+    void evict();
+
+    std::mutex m_mutex;
+    // Most recently used first
+    EntryList m_entries;
+    std::unordered_map<std::string, EntryList::iterator> m_index;
+    size_t m_maxBytes;
+    size_t m_bytes = 0;
+    uint64_t m_hits = 0;
+};
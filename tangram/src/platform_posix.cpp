@@ -5,18 +5,39 @@
 #include <stdio.h>
 #include <stdarg.h>
 #include <iostream>
-#include <fstream>
 #include <functional>
 #include <string>
-#include <list>
-
-#include "urlWorker.h"
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <limits>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "urlClient.h"
+#include "diskCache.h"
+#include "memoryCache.h"
+#include "cachePolicy.h"
+#include "fileView.h"
+#include "fontCache.h"
+#include "tileArchive.h"
+#include "tileUrl.h"
+#include "workerPool.h"
+#include "prefetcher.h"
+#include "trace.h"
+#include "logger.h"
 #include "platform_posix.h"
 #include "gl/hardware.h"
 
 #include <libgen.h>
 #include <unistd.h>
 #include <sys/resource.h>
+#include <sys/stat.h>
 #include <sys/syscall.h>
 
 #ifdef PLATFORM_OSX
@@ -27,43 +48,86 @@
 #define FALLBACK "fonts/DroidSansFallback.ttf"
 #else
 #include <fontconfig.h>
-static std::vector<std::string> s_fallbackFonts;
 static FcConfig* s_fcConfig = nullptr;
+// Fontconfig is not thread safe
+static std::mutex s_fcMutex;
 #endif
 
-#define NUM_WORKERS 10
-
-static bool s_isContinuousRendering = false;
-
-static UrlWorker s_Workers[NUM_WORKERS];
-static std::list<std::unique_ptr<UrlTask>> s_urlTaskQueue;
+static std::atomic<bool> s_isContinuousRendering(false);
+
+// Render requests come from worker threads, maps compare the count with the
+// one they last rendered
+static std::mutex s_renderMutex;
+static std::condition_variable s_renderCondition;
+static uint64_t s_renderRequests = 0;
+
+static std::string matchFontPath(const std::string& _name, const std::string& _weight, const std::string& _face);
+static FontCache s_fontCache(matchFontPath);
+
+// Languages whose fallback fonts come first, the others follow in the order
+// of fontconfig
+static std::mutex s_fallbackMutex;
+static std::vector<std::string> s_fallbackLanguages = {
+    "en", "ar", "he", "ja", "zh-cn", "zh-tw", "ko", "th", "hi", "ru", "el",
+    "ka", "hy", "am", "bn", "ta", "te", "km", "lo", "my", "si"
+};
+
+static std::unique_ptr<UrlClient> s_urlClient;
+static std::unique_ptr<DiskCache> s_diskCache;
+static MemoryCache s_memoryCache(16 * 1024 * 1024);
+
+// Views used to order queued tile requests, one per map. Requests do not
+// tell which map they are for, a tile is as urgent as for the closest view
+struct PriorityView {
+    double lng = 0;
+    double lat = 0;
+    float zoom = -1;
+};
+using PriorityViews = std::vector<PriorityView>;
+static std::mutex s_priorityViewMutex;
+static std::unordered_map<const void*, PriorityView> s_priorityViews;
+
+// Prefetch requests queue behind every request of the view
+#define PREFETCH_PRIORITY 1e6f
+
+// Local files, archive:// tiles and disk cache lookups are read on their own
+// threads, without a transfer. Few threads are enough to keep a slow disk busy
+#define IO_THREADS 4
+static std::unique_ptr<WorkerPool> s_ioPool;
+static std::mutex s_archiveMutex;
+static std::unordered_map<std::string, std::shared_ptr<TileArchive>> s_archives;
+
+// Requests waiting for an I/O job, by url; cancelUrlRequest() drops them.
+// Every request has an id of its own, so a job never answers a request of
+// the same url cancelled before it
+static std::mutex s_ioRequestMutex;
+static std::unordered_map<std::string, std::unordered_set<uint64_t>> s_ioRequestIds;
+static uint64_t s_nextIoRequestId = 1;
+
+// Optional log of every finished transfer, one JSON object per line
+static std::mutex s_requestLogMutex;
+static FILE* s_requestLog = nullptr;
+
+static bool prefetchUrl(const std::string& _url, Prefetcher::DoneCallback _done);
+static bool isPrefetched(const std::string& _url);
+static Prefetcher s_prefetcher(prefetchUrl, isPrefetched);
 
 void logMsg(const char* fmt, ...) {
     va_list args;
     va_start(args, fmt);
-    vfprintf(stderr, fmt, args);
+    logMessage(fmt, args);
     va_end(args);
 }
 
 
-void processNetworkQueue() {
-    // attach workers to NetWorkerData
-    auto taskItr = s_urlTaskQueue.begin();
-    for (auto& worker:s_Workers) {
-        if (taskItr == s_urlTaskQueue.end()) {
-            break;
-        }
-        if (worker.isAvailable()) {
-            worker.perform(std::move(*taskItr));
-            taskItr = s_urlTaskQueue.erase(taskItr);
-        }
+void requestRender() {
+    {
+        std::lock_guard<std::mutex> lock(s_renderMutex);
+        s_renderRequests++;
     }
-}
+    s_renderCondition.notify_all();
 
-void requestRender() {
-    #ifndef PLATFORM_RPI
-    glfwPostEmptyEvent();
-    #endif
+    wakeGL();
 }
 
 void setContinuousRendering(bool _isContinuous) {
@@ -74,209 +138,741 @@ bool isContinuousRendering() {
     return s_isContinuousRendering;
 }
 
+uint64_t getRenderRequests() {
+    std::lock_guard<std::mutex> lock(s_renderMutex);
+    return s_renderRequests;
+}
+
+bool waitRenderRequest(uint64_t _seen, double _timeout) {
+    std::unique_lock<std::mutex> lock(s_renderMutex);
+    return s_renderCondition.wait_for(lock, std::chrono::duration<double>(_timeout),
+                                      [&]() { return s_renderRequests != _seen; });
+}
+
 std::string stringFromFile(const char* _path) {
-    size_t length = 0;
-    unsigned char* bytes = bytesFromFile(_path, length);
-    if (!bytes) { return {}; }
+    size_t size = 0;
+    int fd = openFile(_path, size, true);
+    if (fd < 0) {
+        logMsg("Failed to read file at path: %s\n", _path);
+        return {};
+    }
 
-    std::string out(reinterpret_cast<char*>(bytes), length);
-    free(bytes);
+    // Read straight into the string, no intermediate buffer
+    std::string out(size, '\0');
+    bool ok = readFully(fd, &out[0], size);
+    close(fd);
 
+    if (!ok) {
+        logMsg("Failed to read file at path: %s\n", _path);
+        return {};
+    }
     return out;
 }
 
 unsigned char* bytesFromFile(const char* _path, size_t& _size) {
+    _size = 0;
 
-    std::ifstream resource(_path, std::ifstream::ate | std::ifstream::binary);
-
-    if(!resource.is_open()) {
+    size_t size = 0;
+    int fd = openFile(_path, size, true);
+    if (fd < 0) {
         logMsg("Failed to read file at path: %s\n", _path);
-        _size = 0;
         return nullptr;
     }
 
-    _size = resource.tellg();
-
-    resource.seekg(std::ifstream::beg);
+    // The caller owns the result and releases it with free()
+    char* cdata = (char*) malloc(std::max<size_t>(size, 1));
 
-    char* cdata = (char*) malloc(sizeof(char) * (_size));
+    bool ok = cdata && readFully(fd, cdata, size);
+    close(fd);
 
-    resource.read(cdata, _size);
-    resource.close();
+    if (!ok) {
+        logMsg("Failed to read file at path: %s\n", _path);
+        free(cdata);
+        return nullptr;
+    }
 
+    _size = size;
     return reinterpret_cast<unsigned char *>(cdata);
 }
 
 #ifndef PLATFORM_OSX
-void initPlatformFontSetup() {
-    static bool s_platformFontsInit = false;
-    if (s_platformFontsInit) { return; }
+// Load the fontconfig configuration and, with _fonts, scan the fonts too.
+// The configuration alone is enough to validate a persisted font index.
+// Call with s_fcMutex held
+static bool loadFontConfig(bool _fonts) {
+    static bool s_fontsLoaded = false;
+
+    if (!s_fcConfig) {
+        s_fcConfig = FcInitLoadConfig();
+        if (!s_fcConfig) { return false; }
+    }
+    if (_fonts && !s_fontsLoaded) {
+        if (!FcConfigBuildFonts(s_fcConfig)) {
+            LOGW("Fontconfig could not load the system fonts");
+        }
+        s_fontsLoaded = true;
+    }
+    return true;
+}
+
+// Hash of the fontconfig version and of the modification times of its cache
+// and font directories, which change when fonts are added or removed
+static uint64_t fontConfigSignature(FcConfig* _config) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    auto mix = [&](const void* _data, size_t _size) {
+        const unsigned char* bytes = static_cast<const unsigned char*>(_data);
+        for (size_t i = 0; i < _size; i++) {
+            hash ^= bytes[i];
+            hash *= 0x100000001b3ULL;
+        }
+    };
+
+    int version = FcGetVersion();
+    mix(&version, sizeof(version));
+
+    FcStrList* lists[] = { FcConfigGetCacheDirs(_config), FcConfigGetFontDirs(_config) };
+    for (FcStrList* list : lists) {
+        if (!list) { continue; }
+
+        FcChar8* dir;
+        while ((dir = FcStrListNext(list))) {
+            const char* path = reinterpret_cast<const char*>(dir);
+            mix(path, strlen(path));
 
-    s_fcConfig = FcInitLoadConfigAndFonts();
+            struct stat st;
+            if (stat(path, &st) == 0) {
+                mix(&st.st_mtime, sizeof(st.st_mtime));
+            }
+        }
+        FcStrListDone(list);
+    }
+    return hash;
+}
 
+// Best font of fontconfig for _lang, matched on first use only
+static std::string matchFallbackPath(const std::string& _lang) {
+    std::lock_guard<std::mutex> lock(s_fcMutex);
+
+    if (!loadFontConfig(true)) { return ""; }
+
+    std::string fontFile = "";
     std::string style = "Regular";
 
+    FcValue fcStyleValue, fcLangValue;
+
+    fcStyleValue.type = fcLangValue.type = FcType::FcTypeString;
+    fcStyleValue.u.s = reinterpret_cast<const FcChar8*>(style.c_str());
+    fcLangValue.u.s = reinterpret_cast<const FcChar8*>(_lang.c_str());
+
+    // create a pattern with style and family font properties
+    FcPattern* pat = FcPatternCreate();
+
+    FcPatternAdd(pat, FC_STYLE, fcStyleValue, true);
+    FcPatternAdd(pat, FC_LANG, fcLangValue, true);
+    //FcPatternPrint(pat);
+
+    FcConfigSubstitute(s_fcConfig, pat, FcMatchPattern);
+    FcDefaultSubstitute(pat);
+
+    FcResult res;
+    FcPattern* font = FcFontMatch(s_fcConfig, pat, &res);
+    if (font) {
+        FcChar8* file = nullptr;
+        if (FcPatternGetString(font, FC_FILE, 0, &file) == FcResultMatch) {
+            fontFile = reinterpret_cast<char*>(file);
+        }
+        FcPatternDestroy(font);
+    }
+    FcPatternDestroy(pat);
+
+    return fontFile;
+}
+
+static std::string fallbackPath(const std::string& _lang) {
+    return s_fontCache.lookup("fallback\t" + _lang + "\tRegular", [&]() { return matchFallbackPath(_lang); });
+}
+
+// The priority languages followed by every other language fontconfig knows
+static std::vector<std::string> fallbackLanguages() {
+    std::vector<std::string> languages;
+    {
+        std::lock_guard<std::mutex> lock(s_fallbackMutex);
+        languages = s_fallbackLanguages;
+    }
+
     FcStrSet* fcLangs = FcGetLangs();
     FcStrList* fcLangList = FcStrListCreate(fcLangs);
     FcChar8* fcLang;
     while ((fcLang = FcStrListNext(fcLangList))) {
-        FcValue fcStyleValue, fcLangValue;
-
-        fcStyleValue.type = fcLangValue.type = FcType::FcTypeString;
-        fcStyleValue.u.s = reinterpret_cast<const FcChar8*>(style.c_str());
-        fcLangValue.u.s = fcLang;
-
-        // create a pattern with style and family font properties
-        FcPattern* pat = FcPatternCreate();
-
-        FcPatternAdd(pat, FC_STYLE, fcStyleValue, true);
-        FcPatternAdd(pat, FC_LANG, fcLangValue, true);
-        //FcPatternPrint(pat);
-
-        FcConfigSubstitute(s_fcConfig, pat, FcMatchPattern);
-        FcDefaultSubstitute(pat);
-
-        FcResult res;
-        FcPattern* font = FcFontMatch(s_fcConfig, pat, &res);
-        if (font) {
-            FcChar8* file = nullptr;
-            if (FcPatternGetString(font, FC_FILE, 0, &file) == FcResultMatch) {
-                // Make sure this font file is not previously added.
-                if (std::find(s_fallbackFonts.begin(), s_fallbackFonts.end(),
-                              reinterpret_cast<char*>(file)) == s_fallbackFonts.end()) {
-                    s_fallbackFonts.emplace_back(reinterpret_cast<char*>(file));
-                }
-            }
-            FcPatternDestroy(font);
+        std::string lang = reinterpret_cast<char*>(fcLang);
+        if (std::find(languages.begin(), languages.end(), lang) == languages.end()) {
+            languages.push_back(lang);
         }
-        FcPatternDestroy(pat);
     }
     FcStrListDone(fcLangList);
-    s_platformFontsInit = true;
+    FcStrSetDestroy(fcLangs);
+
+    return languages;
+}
+
+void setFontFallbackLanguages(const std::vector<std::string>& _languages) {
+    std::lock_guard<std::mutex> lock(s_fallbackMutex);
+    s_fallbackLanguages = _languages;
 }
 
+void loadFontFallbacksAsync() {
+    if (!s_ioPool) {
+        logMsg("Font fallback preload before initUrlRequests()\n");
+        return;
+    }
+
+    // One job per language, file requests queued meanwhile are not held up
+    for (auto& lang : fallbackLanguages()) {
+        s_ioPool->enqueue([lang]() { fallbackPath(lang); });
+    }
+}
+
+#else
+
+void setFontFallbackLanguages(const std::vector<std::string>& _languages) {}
+
+void loadFontFallbacksAsync() {}
+
 #endif
 
 std::vector<FontSourceHandle> systemFontFallbacksHandle() {
     std::vector<FontSourceHandle> handles;
 
+    // Fonts are served from the shared font files, a file the fallbacks
+    // of several languages resolve to is loaded once: the others come back
+    // empty. Files are told apart by device and inode, the views themselves
+    // are let go once copied
+    using FileId = std::pair<dev_t, ino_t>;
+    auto loaded = std::make_shared<std::pair<std::mutex, std::vector<FileId>>>();
+    auto load = [loaded](const std::string& _path) -> std::vector<char> {
+        if (_path.empty()) { return {}; }
+
+        struct stat st;
+        auto file = s_fontCache.file(_path);
+        if (!file || stat(_path.c_str(), &st) != 0) {
+            logMsg("Failed to read file at path: %s\n", _path.c_str());
+            return {};
+        }
+        {
+            std::lock_guard<std::mutex> lock(loaded->first);
+            auto& files = loaded->second;
+            FileId id(st.st_dev, st.st_ino);
+            if (std::find(files.begin(), files.end(), id) != files.end()) { return {}; }
+            files.push_back(id);
+        }
+        return std::vector<char>(file->data(), file->data() + file->size());
+    };
+
     #ifdef PLATFORM_OSX
-        handles.emplace_back(DEFAULT);
-        handles.emplace_back(FONT_AR);
-        handles.emplace_back(FONT_HE);
-        handles.emplace_back(FONT_JA);
-        handles.emplace_back(FALLBACK);
+    for (auto path : { DEFAULT, FONT_AR, FONT_HE, FONT_JA, FALLBACK }) {
+        std::string fontFile = path;
+        handles.emplace_back([load, fontFile]() { return load(fontFile); });
+    }
     #else
-    initPlatformFontSetup();
-    for (auto& path : s_fallbackFonts) {
-        handles.emplace_back(path);
+    // One handle per language, matched only when the text engine gets to it
+    // looking for a glyph
+    for (auto& lang : fallbackLanguages()) {
+        handles.emplace_back([load, lang]() { return load(fallbackPath(lang)); });
     }
     #endif
 
     return handles;
 }
 
-// std::string fontFallbackPath(int _importance, int _weightHint) {
-//     #ifndef PLATFORM_OSX
-//     if ((size_t)_importance >= s_fallbackFonts.size()) {
-//         return "";
-//     }
-//     return s_fallbackFonts[_importance];
-//     #else
-//     return "";
-//     #endif
-// }
-
 std::string fontPath(const std::string& _name, const std::string& _weight, const std::string& _face) {
+    return s_fontCache.path(_name, _weight, _face);
+}
+
+unsigned char* systemFont(const std::string& _name, const std::string& _weight, const std::string& _face, size_t* _size) {
+    std::string path = fontPath(_name, _weight, _face);
+
+    if (path.empty()) { return nullptr; }
+
+    // The caller gets its own copy, the view is released right after
+    auto file = s_fontCache.file(path);
+    if (!file) {
+        logMsg("Failed to read file at path: %s\n", path.c_str());
+        return nullptr;
+    }
+
+    unsigned char* data = static_cast<unsigned char*>(malloc(std::max<size_t>(file->size(), 1)));
+    if (!data) { return nullptr; }
+
+    memcpy(data, file->data(), file->size());
+    *_size = file->size();
+    return data;
+}
+
+void initFontCache(const std::string& _path) {
+    uint64_t signature = 0;
     #ifndef PLATFORM_OSX
-    initPlatformFontSetup();
+    {
+        std::lock_guard<std::mutex> lock(s_fcMutex);
+        if (loadFontConfig(false)) {
+            signature = fontConfigSignature(s_fcConfig);
+        }
+    }
+    #endif
+    s_fontCache.persist(_path, signature);
+}
 
-    if (!s_fcConfig) {
-        return "";
+void saveFontCache() {
+    if (!s_fontCache.isDirty()) { return; }
+
+    if (s_ioPool) {
+        s_ioPool->enqueue([]() { s_fontCache.flush(); });
+    } else {
+        s_fontCache.flush();
     }
+}
 
-    std::string fontFile = "";
-    FcValue fcFamily, fcFace, fcWeight;
+static bool onUrlResponse(const std::string& _url, UrlResponse& _response);
 
-    fcFamily.type = fcFace.type = fcWeight.type = FcType::FcTypeString;
-    fcFamily.u.s = reinterpret_cast<const FcChar8*>(_name.c_str());
-    fcWeight.u.s = reinterpret_cast<const FcChar8*>(_weight.c_str());
-    fcFace.u.s = reinterpret_cast<const FcChar8*>(_face.c_str());
+static void logUrlTiming(const std::string& _url, const UrlClient::Timing& _timing) {
+    std::lock_guard<std::mutex> lock(s_requestLogMutex);
+    if (!s_requestLog) { return; }
 
-    // Create a pattern with family, style and weight font properties
-    FcPattern* pattern = FcPatternCreate();
+    std::string url;
+    for (char c : _url) {
+        if (c == '"' || c == '\\') { url += '\\'; }
+        url += c;
+    }
 
-    FcPatternAdd(pattern, FC_FAMILY, fcFamily, true);
-    FcPatternAdd(pattern, FC_STYLE, fcFace, true);
-    FcPatternAdd(pattern, FC_WEIGHT, fcWeight, true);
-    //FcPatternPrint(pattern);
+    fprintf(s_requestLog, "{\"url\":\"%s\",\"status\":%ld,\"bytes\":%llu,\"queue_us\":%llu,"
+            "\"dns_us\":%llu,\"connect_us\":%llu,\"tls_us\":%llu,\"ttfb_us\":%llu,\"total_us\":%llu,"
+            "\"new_connection\":%s}\n",
+            url.c_str(), _timing.status, (unsigned long long)_timing.bytes,
+            (unsigned long long)_timing.queueWait, (unsigned long long)_timing.dns,
+            (unsigned long long)_timing.connect, (unsigned long long)_timing.tls,
+            (unsigned long long)_timing.ttfb, (unsigned long long)_timing.total,
+            _timing.newConnection ? "true" : "false");
+}
 
-    FcConfigSubstitute(s_fcConfig, pattern, FcMatchPattern);
-    FcDefaultSubstitute(pattern);
+void initUrlRequests(UrlClient::Options _options) {
+    s_urlClient.reset(new UrlClient(_options, onUrlResponse));
+    s_urlClient->setTimingCallback(logUrlTiming);
+    s_ioPool.reset(new WorkerPool(IO_THREADS, "io"));
+}
 
-    FcResult res;
-    FcPattern* font = FcFontMatch(s_fcConfig, pattern, &res);
-    if (font) {
-        FcChar8* file = nullptr;
-        FcChar8* fontFamily = nullptr;
-        if (FcPatternGetString(font, FC_FILE, 0, &file) == FcResultMatch &&
-            FcPatternGetString(font, FC_FAMILY, 0, &fontFamily) == FcResultMatch) {
-            // We do not want the "best" match, but an "exact" or at least the same "family" match
-            // We have fallbacks to cover rest here.
-            if (strcmp(reinterpret_cast<const char*>(fontFamily), _name.c_str()) == 0) {
-                fontFile = reinterpret_cast<const char*>(file);
-            }
+bool setUrlRequestLog(const std::string& _path) {
+    std::lock_guard<std::mutex> lock(s_requestLogMutex);
+
+    if (s_requestLog) {
+        fclose(s_requestLog);
+        s_requestLog = nullptr;
+    }
+    if (_path.empty()) { return true; }
+
+    s_requestLog = fopen(_path.c_str(), "a");
+    if (!s_requestLog) {
+        LOGW("Cannot open request log %s", _path.c_str());
+        return false;
+    }
+    return true;
+}
+
+static float urlPriority(const std::string& _url, const PriorityViews& _views) {
+    TileCoord tile;
+    if (_views.empty() || !parseTileUrl(_url, tile)) {
+        // Scenes, textures and fonts block the whole view: serve them first
+        return -1.f;
+    }
+
+    float priority = std::numeric_limits<float>::max();
+    for (auto& view : _views) {
+        priority = std::min(priority, tilePriority(tile, view.lng, view.lat, view.zoom));
+    }
+    return priority;
+}
+
+// Call with s_priorityViewMutex held
+static PriorityViews priorityViews() {
+    PriorityViews views;
+    for (auto& entry : s_priorityViews) { views.push_back(entry.second); }
+    return views;
+}
+
+static void reprioritizeUrlRequests(const PriorityViews& _views) {
+    if (s_urlClient) {
+        s_urlClient->reprioritize([&](const std::string& _url) {
+            return urlPriority(_url, _views);
+        });
+    }
+}
+
+void setUrlPriorityView(const void* _map, double _lng, double _lat, float _zoom) {
+    PriorityViews views;
+    {
+        std::lock_guard<std::mutex> lock(s_priorityViewMutex);
+
+        // Only reorder the queue once the view moved by half a tile or
+        // crossed a zoom level
+        auto it = s_priorityViews.find(_map);
+        if (it != s_priorityViews.end()) {
+            const PriorityView& last = it->second;
+            float scale = std::pow(2.f, std::floor(std::max(0.f, _zoom))) / 360.f;
+            bool zoomChanged = std::floor(last.zoom) != std::floor(_zoom);
+            bool moved = std::abs(last.lng - _lng) * scale > 0.5 ||
+                         std::abs(last.lat - _lat) * scale > 0.5;
+
+            if (!zoomChanged && !moved) { return; }
         }
-        FcPatternDestroy(font);
+
+        s_priorityViews[_map] = { _lng, _lat, _zoom };
+        views = priorityViews();
     }
+    reprioritizeUrlRequests(views);
+}
 
-    FcPatternDestroy(pattern);
+void clearUrlPriorityView(const void* _map) {
+    PriorityViews views;
+    {
+        std::lock_guard<std::mutex> lock(s_priorityViewMutex);
+        if (s_priorityViews.erase(_map) == 0) { return; }
+        views = priorityViews();
+    }
+    reprioritizeUrlRequests(views);
+}
 
-    return fontFile;
-    #else
-    return "";
-    #endif
+void setUrlRequestPriority(const std::string& _url, float _priority) {
+    if (s_urlClient) {
+        s_urlClient->setPriority(_url, _priority);
+    }
 }
 
-unsigned char* systemFont(const std::string& _name, const std::string& _weight, const std::string& _face, size_t* _size) {
-    std::string path = fontPath(_name, _weight, _face);
+void setUrlRequestLimits(uint32_t _maxHostTransfers, uint64_t _maxBytesPerSecond) {
+    if (s_urlClient) {
+        s_urlClient->setLimits(_maxHostTransfers, _maxBytesPerSecond);
+    }
+}
 
-    if (path.empty()) { return nullptr; }
+void initUrlCache(const std::string& _path, uint64_t _maxBytes) {
+    s_diskCache.reset(new DiskCache(_path, _maxBytes));
+    if (!s_diskCache->isValid()) {
+        s_diskCache.reset();
+    }
+}
+
+DiskCache::Stats getUrlCacheStats() {
+    if (s_diskCache) {
+        return s_diskCache->stats();
+    }
+    return DiskCache::Stats();
+}
+
+void setUrlMemoryCacheSize(size_t _maxBytes) {
+    s_memoryCache.setMaxBytes(_maxBytes);
+}
+
+MemoryCache::Stats getUrlMemoryCacheStats() {
+    return s_memoryCache.stats();
+}
+
+static bool isCacheable(const std::string& _url) {
+    return _url.compare(0, 7, "http://") == 0 || _url.compare(0, 8, "https://") == 0;
+}
+
+// Conditional request headers to revalidate a stale cache entry
+static void addValidators(const DiskCache::Lookup& _cached, std::vector<std::string>& _headers) {
+    if (!_cached.etag.empty()) {
+        _headers.push_back("If-None-Match: " + _cached.etag);
+    }
+    if (!_cached.lastModified.empty()) {
+        _headers.push_back("If-Modified-Since: " + _cached.lastModified);
+    }
+}
+
+// Runs once per finished transfer, before the response is fanned out to the
+// callbacks of all requests for _url
+static bool onUrlResponse(const std::string& _url, UrlResponse& _response) {
+    if (!isCacheable(_url)) { return true; }
+
+    if (_response.status == 304) {
+        if (s_diskCache && s_diskCache->revalidate(_url, _response, _response.content)) {
+            _response.status = 200;
+        } else {
+            // Evicted meanwhile: fetch it in full
+            logMsg("Cache entry vanished during revalidation: %s\n", _url.c_str());
+            return false;
+        }
+    } else if (_response.status == 200 && s_diskCache) {
+        s_diskCache->store(_url, _response);
+    }
+
+    int64_t now = cacheTime();
+    int64_t expires = 0;
+    if (_response.status == 200 && cacheExpiry(_response, now, expires) && expires > now) {
+        s_memoryCache.put(_url, _response.content, expires);
+    }
+    return true;
+}
+
+void readFileAsync(const std::string& _path, UrlCallback _callback) {
+    if (!s_ioPool) {
+        logMsg("File request before initUrlRequests(): %s\n", _path.c_str());
+        _callback({});
+        return;
+    }
+
+    s_ioPool->enqueue([_path, _callback]() {
+        std::vector<char> content;
+        if (!readFile(_path, content)) {
+            logMsg("Failed to read file at path: %s\n", _path.c_str());
+        }
+        _callback(std::move(content));
+    });
+}
+
+// Path of a file:// url, with %XX escapes decoded
+static std::string fileUrlPath(const std::string& _url) {
+    std::string path;
+    for (size_t i = 7; i < _url.size(); i++) {
+        if (_url[i] == '%' && i + 2 < _url.size() && isxdigit(_url[i + 1]) && isxdigit(_url[i + 2])) {
+            path += char(std::stoi(_url.substr(i + 1, 2), nullptr, 16));
+            i += 2;
+        } else {
+            path += _url[i];
+        }
+    }
+    return path;
+}
+
+// Archives are opened on first use and stay open, a failed open is not retried
+static std::shared_ptr<TileArchive> tileArchive(const std::string& _path) {
+    std::lock_guard<std::mutex> lock(s_archiveMutex);
+
+    auto it = s_archives.find(_path);
+    if (it == s_archives.end()) {
+        it = s_archives.emplace(_path, TileArchive::open(_path)).first;
+    }
+    return it->second;
+}
+
+static void queueUrlRequest(const std::string& _url, std::vector<std::string> _headers,
+                            UrlResponseCallback _callback) {
+    PriorityViews views;
+    {
+        std::lock_guard<std::mutex> lock(s_priorityViewMutex);
+        views = priorityViews();
+    }
+    s_urlClient->addRequest(_url, std::move(_headers), std::move(_callback), urlPriority(_url, views));
+}
+
+static uint64_t addIoRequest(const std::string& _url) {
+    std::lock_guard<std::mutex> lock(s_ioRequestMutex);
+    uint64_t id = s_nextIoRequestId++;
+    s_ioRequestIds[_url].insert(id);
+    return id;
+}
 
-    return bytesFromFile(path.c_str(), *_size);
+// False when request _id was cancelled since addIoRequest(), called with
+// s_ioRequestMutex held
+static bool takeIoRequest(const std::string& _url, uint64_t _id) {
+    auto it = s_ioRequestIds.find(_url);
+    if (it == s_ioRequestIds.end() || it->second.erase(_id) == 0) { return false; }
+    if (it->second.empty()) { s_ioRequestIds.erase(it); }
+    return true;
 }
 
 bool startUrlRequest(const std::string& _url, UrlCallback _callback) {
-    std::unique_ptr<UrlTask> task(new UrlTask(_url, _callback));
-    for (auto& worker:s_Workers) {
-        if(worker.isAvailable()) {
-            worker.perform(std::move(task));
+    TRACE_SCOPE("startUrlRequest", "network");
+
+    // Links the request to its callback, whichever thread runs it
+    uint64_t flow = traceFlowStart("url request");
+    if (flow) {
+        _callback = [flow, callback = std::move(_callback)](std::vector<char>&& _content) {
+            TRACE_SCOPE("url callback", "network");
+            traceFlowEnd("url request", flow);
+            callback(std::move(_content));
+        };
+    }
+
+    if (!s_urlClient) {
+        logMsg("URL request before initUrlRequests(): %s\n", _url.c_str());
+        return false;
+    }
+
+    // Local files never go through curl
+    if (_url.compare(0, 7, "file://") == 0) {
+        readFileAsync(fileUrlPath(_url), _callback);
+        return true;
+    }
+    if (!_url.empty() && _url[0] == '/') {
+        readFileAsync(_url, _callback);
+        return true;
+    }
+
+    std::string archivePath;
+    TileCoord archiveTile;
+    if (parseArchiveUrl(_url, archivePath, archiveTile)) {
+        uint64_t request = addIoRequest(_url);
+        s_ioPool->enqueue([_url, request, archivePath, archiveTile, _callback]() {
+            // Tiles left behind by the view are not read at all
+            {
+                std::lock_guard<std::mutex> lock(s_ioRequestMutex);
+                if (!takeIoRequest(_url, request)) { return; }
+            }
+
+            std::vector<char> content;
+            auto archive = tileArchive(archivePath);
+            if (archive && !archive->get(archiveTile, content)) {
+                // Answered like a failed request, unlike an empty tile
+                logMsg("Tile not in archive: %s\n", _url.c_str());
+            }
+            _callback(std::move(content));
+        });
+        return true;
+    }
+
+    auto onResponse = [_callback](UrlResponse&& _response) {
+        _callback(std::move(_response.content));
+    };
+
+    std::vector<std::string> headers;
+
+    if (isCacheable(_url)) {
+        s_prefetcher.observe(_url);
+
+        // Hits need no transfer, they are handed to the callback threads as they are
+        UrlResponse response;
+        response.status = 200;
+
+        if (s_memoryCache.get(_url, cacheTime(), response.content)) {
+            s_urlClient->addResponse(_url, std::move(response), onResponse);
+            return true;
+        }
+
+        // The disk lookup opens and reads a file, which the render thread
+        // calling us must not wait for
+        if (s_diskCache) {
+            uint64_t request = addIoRequest(_url);
+            s_ioPool->enqueue([_url, request, onResponse]() {
+                std::vector<std::string> headers;
+                DiskCache::Lookup cached = s_diskCache->lookup(_url);
+                if (cached.fresh) {
+                    s_memoryCache.put(_url, cached.content, cached.expires);
+                }
+
+                std::lock_guard<std::mutex> lock(s_ioRequestMutex);
+                if (!takeIoRequest(_url, request)) { return; }
+
+                if (cached.fresh) {
+                    UrlResponse response;
+                    response.status = 200;
+                    response.content = std::move(cached.content);
+                    s_urlClient->addResponse(_url, std::move(response), onResponse);
+                    return;
+                }
+                if (cached.found) {
+                    // Stale: ask the server whether our copy is still good
+                    addValidators(cached, headers);
+                }
+                queueUrlRequest(_url, std::move(headers), onResponse);
+            });
             return true;
         }
     }
-    s_urlTaskQueue.push_back(std::move(task));
-    return true;
 
+    queueUrlRequest(_url, std::move(headers), onResponse);
+    return true;
 }
 
 void cancelUrlRequest(const std::string& _url) {
+    // Ordered with the I/O job handing the request to the client
+    std::lock_guard<std::mutex> lock(s_ioRequestMutex);
+    s_ioRequestIds.erase(_url);
 
-    // Only clear this request if a worker has not started operating on it!
-    // otherwise it gets too convoluted with curl!
-    auto itr = s_urlTaskQueue.begin();
-    while(itr != s_urlTaskQueue.end()) {
-        if((*itr)->url == _url) {
-            itr = s_urlTaskQueue.erase(itr);
-        } else {
-            itr++;
+    if (s_urlClient) {
+        s_urlClient->cancelRequest(_url);
+    }
+}
+
+UrlClient::Stats getUrlRequestStats() {
+    if (s_urlClient) {
+        return s_urlClient->stats();
+    }
+    return UrlClient::Stats();
+}
+
+static bool prefetchUrl(const std::string& _url, Prefetcher::DoneCallback _done) {
+    if (!s_urlClient) { return false; }
+
+    // Pinned: the prefetch goes on when the map cancels its own request
+    auto onResponse = [_done](UrlResponse&& _response) {
+        _done(_response.status == 200, _response.content.size());
+    };
+
+    if (!s_diskCache) {
+        s_urlClient->addRequest(_url, {}, onResponse, PREFETCH_PRIORITY, true);
+        return true;
+    }
+
+    s_ioPool->enqueue([_url, onResponse]() {
+        std::vector<std::string> headers;
+        DiskCache::Lookup cached = s_diskCache->lookup(_url);
+        if (cached.found && !cached.fresh) {
+            addValidators(cached, headers);
         }
+        s_urlClient->addRequest(_url, std::move(headers), onResponse, PREFETCH_PRIORITY, true);
+    });
+    return true;
+}
+
+static bool isPrefetched(const std::string& _url) {
+    return s_diskCache && s_diskCache->isFresh(_url);
+}
+
+void addUrlPrefetchTemplate(const std::string& _template) {
+    s_prefetcher.addTemplate(_template);
+}
+
+void clearUrlPrefetchTemplates() {
+    s_prefetcher.clear();
+}
+
+bool hasUrlCache() {
+    return s_diskCache != nullptr;
+}
+
+bool canUrlPrefetch() {
+    return s_diskCache && s_prefetcher.hasTemplates();
+}
+
+bool startUrlPrefetch(std::vector<TileCoord> _tiles, uint64_t _maxBytes) {
+    if (!s_diskCache) {
+        LOGW("Prefetching needs a disk cache, set cachePath in init()");
+        return false;
     }
+    return s_prefetcher.start(std::move(_tiles), _maxBytes);
+}
+
+void cancelUrlPrefetch() {
+    s_prefetcher.cancel();
+}
+
+Prefetcher::Progress getUrlPrefetchProgress() {
+    return s_prefetcher.progress();
 }
 
 void finishUrlRequests() {
-    for (auto& worker:s_Workers) {
-        worker.join();
+    s_prefetcher.cancel();
+    s_ioPool.reset();
+    {
+        std::lock_guard<std::mutex> lock(s_ioRequestMutex);
+        s_ioRequestIds.clear();
     }
+    s_urlClient.reset();
+    // Writes the cache index
+    s_diskCache.reset();
+    setUrlRequestLog("");
+
+    std::lock_guard<std::mutex> lock(s_archiveMutex);
+    s_archives.clear();
 }
 
 void setCurrentThreadPriority(int priority){
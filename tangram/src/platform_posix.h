@@ -1,6 +1,62 @@
 #pragma once
 
 #include "platform.h"
+#include "urlClient.h"
+#include "diskCache.h"
+#include "memoryCache.h"
+#include "prefetcher.h"
 
-void processNetworkQueue();
+// Number of requestRender() calls so far
+uint64_t getRenderRequests();
+// Block until a render is requested after _seen requests, or _timeout
+// seconds passed; false on timeout
+bool waitRenderRequest(uint64_t _seen, double _timeout);
+
+void initUrlRequests(UrlClient::Options _options);
 void finishUrlRequests();
+UrlClient::Stats getUrlRequestStats();
+void setUrlRequestLimits(uint32_t _maxHostTransfers, uint64_t _maxBytesPerSecond);
+// Append the timing of every finished transfer to _path, "" stops logging
+bool setUrlRequestLog(const std::string& _path);
+
+// Persist font matches in _path for later runs, "" keeps them in memory only
+void initFontCache(const std::string& _path);
+// Write font matches made since the last call to the file, on the I/O threads
+void saveFontCache();
+// Languages whose fallback fonts are tried first for missing glyphs
+void setFontFallbackLanguages(const std::vector<std::string>& _languages);
+// Match the fallback font of every language on the I/O threads
+void loadFontFallbacksAsync();
+
+// Read _path on the I/O threads and hand its content, empty when it cannot
+// be read, to _callback there. file:// urls passed to startUrlRequest()
+// are served this way
+void readFileAsync(const std::string& _path, UrlCallback _callback);
+
+// Keep HTTP responses in _path, using at most _maxBytes of disk
+void initUrlCache(const std::string& _path, uint64_t _maxBytes);
+DiskCache::Stats getUrlCacheStats();
+
+// Byte budget of the in-memory LRU of recent responses
+void setUrlMemoryCacheSize(size_t _maxBytes);
+MemoryCache::Stats getUrlMemoryCacheStats();
+
+// Queued tile requests are served closest to the view of _map first. With
+// several maps, a tile counts as close as it is to the nearest of their views
+void setUrlPriorityView(const void* _map, double _lng, double _lat, float _zoom);
+// Drop the view of a closed map
+void clearUrlPriorityView(const void* _map);
+// Override the queue priority of a request (lower is sooner)
+void setUrlRequestPriority(const std::string& _url, float _priority);
+
+// Download tiles ahead of time into the disk cache, see Prefetcher
+void addUrlPrefetchTemplate(const std::string& _template);
+// Forget the tile sources learned from the previous scene
+void clearUrlPrefetchTemplates();
+bool startUrlPrefetch(std::vector<TileCoord> _tiles, uint64_t _maxBytes);
+// Whether startUrlPrefetch() can start now: a disk cache and a known tile
+// source, learned from the first requests of the scene
+bool canUrlPrefetch();
+bool hasUrlCache();
+void cancelUrlPrefetch();
+Prefetcher::Progress getUrlPrefetchProgress();
@@ -0,0 +1,196 @@
+#include "prefetcher.h"
+#include "log.h"
+
+// Prefetch requests queued at the same time
+#define PREFETCH_WINDOW 8
+#define MAX_TEMPLATES 8
+
+struct Prefetcher::Job {
+    FetchFunction fetch;
+    CachedFunction isCached;
+    std::vector<TileCoord> tiles;
+    std::vector<std::string> templates;
+    uint64_t maxBytes = 0;
+
+    std::mutex mutex;
+    // Next tile and template pair, as tile * templates.size() + template
+    size_t next = 0;
+    uint32_t active = 0;
+    bool cancelled = false;
+    Progress progress;
+};
+
+// Template without its first host label, the subdomains of a source share it
+static std::string sourceKey(const std::string& _template) {
+    size_t host = _template.find("://");
+    host = (host == std::string::npos) ? 0 : host + 3;
+
+    size_t dot = _template.find('.', host);
+    size_t slash = _template.find('/', host);
+    if (dot == std::string::npos || dot > slash) { return _template; }
+
+    return _template.substr(0, host) + _template.substr(dot);
+}
+
+Prefetcher::Prefetcher(FetchFunction _fetch, CachedFunction _isCached)
+    : m_fetch(_fetch), m_isCached(_isCached) {}
+
+void Prefetcher::observe(const std::string& _url) {
+    std::string urlTemplate;
+    if (!tileUrlTemplate(_url, urlTemplate)) { return; }
+
+    add(urlTemplate, true);
+}
+
+void Prefetcher::addTemplate(const std::string& _template) {
+    add(_template, false);
+}
+
+void Prefetcher::add(const std::string& _template, bool _learned) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    std::string key = sourceKey(_template);
+    for (size_t i = 0; i < m_templates.size(); i++) {
+        if (sourceKey(m_templates[i]) == key) {
+            // Added explicitly, it stays when the scene changes
+            if (!_learned) { m_learned[i] = false; }
+            return;
+        }
+    }
+
+    if (m_templates.size() >= MAX_TEMPLATES) {
+        m_templates.erase(m_templates.begin());
+        m_learned.erase(m_learned.begin());
+    }
+    m_templates.push_back(_template);
+    m_learned.push_back(_learned);
+}
+
+void Prefetcher::clear() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    size_t kept = 0;
+    for (size_t i = 0; i < m_templates.size(); i++) {
+        if (m_learned[i]) { continue; }
+        m_templates[kept] = std::move(m_templates[i]);
+        m_learned[kept] = false;
+        kept++;
+    }
+    m_templates.resize(kept);
+    m_learned.resize(kept);
+
+    if (m_job) {
+        std::lock_guard<std::mutex> jobLock(m_job->mutex);
+        m_job->cancelled = true;
+        if (m_job->active == 0) { m_job->progress.running = false; }
+    }
+}
+
+bool Prefetcher::hasTemplates() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return !m_templates.empty();
+}
+
+bool Prefetcher::start(std::vector<TileCoord> _tiles, uint64_t _maxBytes) {
+    std::shared_ptr<Job> job(new Job());
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        if (m_templates.empty()) {
+            LOGW("No tile source known for prefetching yet");
+            return false;
+        }
+
+        if (m_job) {
+            std::lock_guard<std::mutex> jobLock(m_job->mutex);
+            m_job->cancelled = true;
+        }
+
+        job->fetch = m_fetch;
+        job->isCached = m_isCached;
+        job->templates = m_templates;
+        job->tiles = std::move(_tiles);
+        job->maxBytes = _maxBytes;
+        job->progress.total = job->tiles.size() * job->templates.size();
+        job->progress.running = true;
+
+        m_job = job;
+    }
+
+    pump(job);
+    return true;
+}
+
+void Prefetcher::cancel() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (m_job) {
+        std::lock_guard<std::mutex> jobLock(m_job->mutex);
+        m_job->cancelled = true;
+        if (m_job->active == 0) { m_job->progress.running = false; }
+    }
+}
+
+Prefetcher::Progress Prefetcher::progress() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (!m_job) { return Progress(); }
+
+    std::lock_guard<std::mutex> jobLock(m_job->mutex);
+    return m_job->progress;
+}
+
+void Prefetcher::pump(const std::shared_ptr<Job>& _job) {
+
+    std::vector<std::string> urls;
+    {
+        std::lock_guard<std::mutex> lock(_job->mutex);
+
+        const size_t numTemplates = _job->templates.size();
+        const size_t count = _job->tiles.size() * numTemplates;
+
+        while (!_job->cancelled && _job->next < count &&
+               _job->active + urls.size() < PREFETCH_WINDOW &&
+               _job->progress.bytes < _job->maxBytes) {
+
+            size_t i = _job->next++;
+            std::string url = tileUrl(_job->templates[i % numTemplates], _job->tiles[i / numTemplates]);
+
+            if (_job->isCached(url)) {
+                _job->progress.cached++;
+                _job->progress.done++;
+                continue;
+            }
+            urls.push_back(std::move(url));
+        }
+        _job->active += urls.size();
+
+        // Nothing running and nothing more could be started
+        if (_job->active == 0) { _job->progress.running = false; }
+    }
+
+    for (auto& url : urls) {
+        bool started = _job->fetch(url, [_job](bool _ok, size_t _bytes) {
+            {
+                std::lock_guard<std::mutex> lock(_job->mutex);
+                _job->active--;
+                _job->progress.done++;
+                if (_ok) {
+                    _job->progress.bytes += _bytes;
+                } else {
+                    _job->progress.failed++;
+                }
+            }
+            pump(_job);
+        });
+
+        if (!started) {
+            std::lock_guard<std::mutex> lock(_job->mutex);
+            _job->active--;
+            _job->progress.done++;
+            _job->progress.failed++;
+            _job->cancelled = true;
+            if (_job->active == 0) { _job->progress.running = false; }
+        }
+    }
+}
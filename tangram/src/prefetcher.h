@@ -0,0 +1,78 @@
+#pragma once
+
+#include "tileUrl.h"
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Downloads the tiles of an area or a route ahead of time, so that they come
+// from the cache when the view gets there. Tile URL templates are learned
+// from the tile requests of the scene or added explicitly. Only a few
+// requests are queued at a time, so the prefetch never delays what the
+// current view needs.
+//
+// Subdomains of a source (a.tile..., b.tile...) are learned as one template.
+class Prefetcher {
+
+public:
+
+    struct Progress {
+        uint64_t total = 0;     // tile urls to prefetch
+        uint64_t done = 0;      // fetched, failed or already cached
+        uint64_t cached = 0;    // already fresh in the cache
+        uint64_t failed = 0;
+        uint64_t bytes = 0;     // downloaded so far
+        bool running = false;
+    };
+
+    using DoneCallback = std::function<void(bool _ok, size_t _bytes)>;
+    // Start a request for _url which calls _done when finished, returns
+    // false when no request can be made
+    using FetchFunction = std::function<bool(const std::string& _url, DoneCallback _done)>;
+    using CachedFunction = std::function<bool(const std::string& _url)>;
+
+    Prefetcher(FetchFunction _fetch, CachedFunction _isCached);
+
+    // Learn the template of a tile url requested by the scene
+    void observe(const std::string& _url);
+
+    // Add a template with {z}, {x} and {y} placeholders
+    void addTemplate(const std::string& _template);
+
+    // Forget the templates learned from the scene and cancel the running
+    // prefetch, when another scene is loaded. Added templates are kept
+    void clear();
+
+    // Whether start() has a template to fetch from
+    bool hasTemplates();
+
+    // Fetch _tiles from every known template until _maxBytes were downloaded,
+    // replacing any running prefetch. Returns false when no template is known
+    bool start(std::vector<TileCoord> _tiles, uint64_t _maxBytes);
+
+    // Requests already queued still finish
+    void cancel();
+
+    Progress progress();
+
+private:
+
+    struct Job;
+
+    void add(const std::string& _template, bool _learned);
+
+    static void pump(const std::shared_ptr<Job>& _job);
+
+    const FetchFunction m_fetch;
+    const CachedFunction m_isCached;
+
+    std::mutex m_mutex;
+    std::vector<std::string> m_templates;
+    // Whether m_templates[i] was learned by observe()
+    std::vector<bool> m_learned;
+    std::shared_ptr<Job> m_job;
+};
@@ -9,8 +9,12 @@
 
 #include "context.h"
 #include "platform_posix.h" // Darwin Linux and RPi
+#include "trace.h"
+#include "logger.h"
 
+#include <algorithm>
 #include <iostream>
+#include <mutex>
 #include <curl/curl.h>      // Curl
 
 #define KEY_ZOOM_IN  45     // -
@@ -30,263 +34,1030 @@
 #define KEY_LEFT     263
 #define KEY_RIGHT    262
 #define KEY_DOWN     264
-#endif 
-
-// Tangram
-Tangram::Map* map = nullptr;
-
-bool bFinish = false;
-std::string sceneFile = "scene.yaml";
+#endif
 
 const double double_tap_time = 0.5; // seconds
 const double scroll_span_multiplier = 0.05; // scaling for zoom and rotation
 const double scroll_distance_multiplier = 5.0; // scaling for shove
-float pixel_scale = 1.0;
+const double idle_wait = 0.25; // seconds update() blocks when there is nothing to draw
+
+// Views queued for batch rendering
+struct BatchView {
+    double lng, lat;
+    float zoom, rotation, tilt;
+    int width, height;
+};
+
+// Everything one map keeps, reached from the event callbacks of its context
+// through getGLUserData()
+struct MapState {
+    TangramMap* owner = nullptr;
+    GLContext* context = nullptr;
+
+    // Tangram
+    Tangram::Map* map = nullptr;
+
+    bool bFinish = false;
+    bool bDirty = true;     // changed since the last frame rendered
+    bool bRendered = false;
+    uint64_t renderRequests = 0;
+    bool bClosing = false;  // asked from its window, closed after the events
+    std::string sceneFile = "scene.yaml";
+    float pixel_scale = 1.0;
+
+    double last_time_released = -double_tap_time; // First click should never trigger a double tap
+    int keyPressed = 0;
+
+    std::vector<BatchView> batchViews;
+    size_t batchNext = 0;
+    // View captured last, returned once the next one rendered
+    bool batchPending = false;
+    uint64_t batchPendingIndex = 0;
+    // Lookahead was asked for but could not prefetch, logged once per batch
+    bool batchNoLookahead = false;
+
+    FramePacer pacer;
+    FrameTimer timer;
+
+    FrameReader frameReader;
+    bool frameCapture = false;
+    uint64_t frameIndex = 0;
+
+    std::shared_ptr<Tangram::ClientGeoJsonSource> data_source;
+    Tangram::LngLat last_point;
+};
 
-double last_time_released = -double_tap_time; // First click should never trigger a double tap
-int keyPressed = 0;
+// The map of init(), driven by the module functions
+static TangramMap* defaultMap = nullptr;
+static bool defaultNetwork = false;
 
-std::shared_ptr<Tangram::ClientGeoJsonSource> data_source;
-Tangram::LngLat last_point;
+// URL requests and caches are shared by all maps, they stop with the last
+static std::mutex networkMutex;
+static int networkUsers = 0;
+
+// Returns true when the network was started by this call
+static bool acquireNetwork(const UrlClient::Options& _options) {
+    std::lock_guard<std::mutex> lock(networkMutex);
+    if (networkUsers++ > 0) { return false; }
 
-void init(int width, int height, char * style) {
      // Initialize cURL
     curl_global_init(CURL_GLOBAL_DEFAULT);
+    initUrlRequests(_options);
+    return true;
+}
+
+static void releaseNetwork() {
+    std::lock_guard<std::mutex> lock(networkMutex);
+    if (--networkUsers > 0) { return; }
 
-    sceneFile = std::string(style);
+    finishUrlRequests();
+    curl_global_cleanup();
+}
+
+static Distribution distribution(const Histogram::Summary& _summary, double _scale) {
+    Distribution rta;
+    rta.count = _summary.count;
+    rta.mean = _summary.mean * _scale;
+    rta.p50 = _summary.p50 * _scale;
+    rta.p95 = _summary.p95 * _scale;
+    rta.p99 = _summary.p99 * _scale;
+    rta.max = _summary.max * _scale;
+    return rta;
+}
+
+// Map whose context events are delivered for
+static MapState* eventMap() {
+    MapState* state = static_cast<MapState*>(getGLUserData());
+    return (state && state->map) ? state : nullptr;
+}
+
+TangramMap::TangramMap(int width, int height, char * style, bool headless) : m_state(new MapState()) {
+    MapState& s = *m_state;
+    s.owner = this;
+
+    acquireNetwork(UrlClient::Options());
+
+    s.sceneFile = std::string(style);
+    setTraceThreadName("map");
 
     // Start OpenGL ES context
     LOG("Creating OpenGL ES context");
-    initGL(width, height);
+    s.context = createGL(width, height, headless, m_state);
 
     LOG("Creating a new TANGRAM instances");
-    map = new Tangram::Map();
-    map->loadSceneAsync(style);
-    map->setupGL();
-    pixel_scale = getDevicePixelRatio();
-    map->setPixelScale(pixel_scale);
-    map->resize(getWindowWidth(), getWindowHeight());
+    s.map = new Tangram::Map();
+    s.map->loadSceneAsync(style);
+    s.map->setupGL();
+    s.pixel_scale = getDevicePixelRatio();
+    s.map->setPixelScale(s.pixel_scale);
+    s.map->resize(getWindowWidth(), getWindowHeight());
 }
 
-bool isRunning() {
-    return map != nullptr;
+TangramMap::~TangramMap() {
+    close();
+    delete m_state;
 }
 
-void loadScene(char * style, bool _useScenePosition) {
-    if (map) {
-        sceneFile = std::string(style);
-        map->loadScene(style, _useScenePosition);
+void TangramMap::close() {
+    MapState& s = *m_state;
+    if (!s.context) { return; }
+
+    clearUrlPriorityView(&s);
+    releaseNetwork();
+
+    makeCurrentGL(s.context);
+    if (s.map) {
+        delete s.map;
+        s.map = nullptr;
     }
+
+    s.frameReader.release();
+    destroyGL(s.context);
+    s.context = nullptr;
 }
 
-void loadSceneAsync(char * style, bool _useScenePosition) {
-    if (map) {
-        sceneFile = std::string(style);
-        map->loadSceneAsync(style, _useScenePosition);
+bool TangramMap::isRunning() {
+    return m_state->map != nullptr;
+}
+
+void TangramMap::loadScene(char * style, bool _useScenePosition) {
+    MapState& s = *m_state;
+    if (s.map) {
+        s.sceneFile = std::string(style);
+        clearUrlPrefetchTemplates();
+        s.map->loadScene(style, _useScenePosition);
+        s.bDirty = true;
     }
 }
 
-void queueSceneUpdate(const char* _path, const char* _value) {
-    if (map) {
-        map->queueSceneUpdate(_path, _value);
+void TangramMap::loadSceneAsync(char * style, bool _useScenePosition) {
+    MapState& s = *m_state;
+    if (s.map) {
+        s.sceneFile = std::string(style);
+        clearUrlPrefetchTemplates();
+        s.map->loadSceneAsync(style, _useScenePosition);
+        s.bDirty = true;
     }
 }
 
-void applySceneUpdates() {
-    if (map) {
-        map->applySceneUpdates();
+void TangramMap::queueSceneUpdate(const char* _path, const char* _value) {
+    if (m_state->map) {
+        m_state->map->queueSceneUpdate(_path, _value);
     }
 }
 
-bool update() {
-    // Update Network Queue
-    processNetworkQueue();
+void TangramMap::applySceneUpdates() {
+    if (m_state->map) {
+        m_state->map->applySceneUpdates();
+        m_state->bDirty = true;
+    }
+}
+
+bool TangramMap::update() {
+    MapState& s = *m_state;
+    s.bRendered = false;
+    if (!s.map) { return s.bFinish; }
+
+    TRACE_SCOPE("update");
+
+    makeCurrentGL(s.context);
+
+    // Nothing changed, nothing loading or animating: sleep until an event or
+    // a render request instead of redrawing the same frame
+    double wait = 0.0;
+    if (!s.bDirty && s.bFinish && !isContinuousRendering() &&
+        getRenderRequests() == s.renderRequests) {
+        #ifndef PLATFORM_RPI
+        if (!isHeadless()) {
+            wait = idle_wait;
+        } else
+        #endif
+        {
+            waitRenderRequest(s.renderRequests, idle_wait);
+        }
+    }
+
+    if (wait == 0.0) {
+        s.pacer.wait();
+    }
+
+    // Phases are recorded once the update turns out to draw a frame, idle
+    // updates would only dilute the percentiles
+    using Clock = FrameTimer::Clock;
+    Clock::time_point start = Clock::now();
+
+    // Serve queued tiles closest to the current view first
+    double lng, lat;
+    s.map->getPosition(lng, lat);
+    setUrlPriorityView(&s, lng, lat, s.map->getZoom());
+    Clock::time_point network = Clock::now();
+
+    // Update Tangram
+    {
+        TRACE_SCOPE("updateGL");
+        updateGL(wait);
+    }
+
+    Clock::time_point events = Clock::now();
+
+    // Its window is gone only once the event callbacks returned
+    if (s.bClosing) {
+        close();
+        return true;
+    }
+
+    uint64_t requests = getRenderRequests();
+    bool requested = requests != s.renderRequests;
+    s.renderRequests = requests;
 
-    if (map) {
-        // Update Tangram
-        updateGL();
-        bFinish = map->update(getDelta());
+    // An incomplete view is still loading or animating, the frame after it
+    // completes is drawn as well
+    bool wasFinished = s.bFinish;
+    {
+        TRACE_SCOPE("Map::update");
+        s.bFinish = s.map->update(getDelta());
+    }
+    Clock::time_point updated = Clock::now();
+
+    // The fonts of a loaded scene are all matched by now
+    if (s.bFinish && !wasFinished) {
+        saveFontCache();
+    }
 
-        map->render();
+    if (!s.bDirty && !requested && !isContinuousRendering() && s.bFinish && wasFinished) {
+        return s.bFinish;
     }
+    s.bDirty = false;
 
-    renderGL();
-    return bFinish;
+    {
+        TRACE_SCOPE("Map::render");
+        s.map->render();
+        s.frameIndex++;
+
+        // Before the swap, the back buffer is undefined after it
+        if (s.frameCapture) {
+            s.frameReader.capture(s.frameIndex, getWindowWidth(), getWindowHeight());
+        }
+    }
+    Clock::time_point rendered = Clock::now();
+
+    {
+        TRACE_SCOPE("renderGL");
+        renderGL();
+    }
+    Clock::time_point swapped = Clock::now();
+
+    // Waiting for events while idle is no work, polling then is not told
+    // apart from the wait
+    Clock::duration polling = wait == 0.0 ? events - network : Clock::duration::zero();
+
+    s.timer.record(FrameTimer::NETWORK, network - start);
+    s.timer.record(FrameTimer::EVENTS, polling);
+    s.timer.record(FrameTimer::UPDATE, updated - events);
+    s.timer.record(FrameTimer::RENDER, rendered - updated);
+    s.timer.record(FrameTimer::SWAP, swapped - rendered);
+    s.timer.record(FrameTimer::FRAME, (network - start) + polling + (swapped - events));
+    s.pacer.frameDone();
+    s.bRendered = true;
+    return s.bFinish;
 }
 
-void close() {
-    finishUrlRequests();
-    curl_global_cleanup();
+bool TangramMap::wasFrameRendered() {
+    return m_state->bRendered;
+}
 
-    if (map) {
-        delete map;
-        map = nullptr;
+void TangramMap::setTargetFps(double fps) {
+    m_state->pacer.setTargetFps(fps);
+}
+
+void TangramMap::setVsync(bool enabled) {
+    MapState& s = *m_state;
+    if (s.context) {
+        makeCurrentGL(s.context);
+        ::setVsync(enabled);
     }
+}
 
-    closeGL();
+void TangramMap::setPacingStrategy(PacingStrategy strategy) {
+    m_state->pacer.setStrategy(FramePacer::Strategy(strategy));
 }
 
-float getPixelScale() {
-    if (map) {
-        return map->getPixelScale();
+double TangramMap::getFrameTimeLeft() {
+    return m_state->pacer.timeLeft();
+}
+
+Distribution TangramMap::getFrameStats(FramePhase phase) {
+    // Microseconds to milliseconds
+    return distribution(m_state->timer.summary(FrameTimer::Phase(phase)), 1e-3);
+}
+
+void TangramMap::resetFrameStats() {
+    m_state->timer.reset();
+}
+
+void TangramMap::setFrameCapture(bool enabled) {
+    m_state->frameCapture = enabled;
+}
+
+// Pixels of the frame update() rendered last
+static std::shared_ptr<const PixelFrame> readCurrentFrame(MapState& _s) {
+    // A window has swapped the frame to its front buffer already
+    #ifndef PLATFORM_RPI
+    if (!isHeadless()) { glReadBuffer(GL_FRONT); }
+    #endif
+
+    auto frame = _s.frameReader.readNow(_s.frameIndex, getWindowWidth(), getWindowHeight());
+
+    #ifndef PLATFORM_RPI
+    if (!isHeadless()) { glReadBuffer(GL_BACK); }
+    #endif
+
+    return frame;
+}
+
+std::shared_ptr<const PixelFrame> TangramMap::readPixels() {
+    MapState& s = *m_state;
+    if (!s.context) { return nullptr; }
+
+    makeCurrentGL(s.context);
+    if (!isGL()) { return nullptr; }
+
+    if (s.frameCapture) {
+        return s.frameReader.read();
+    }
+    return readCurrentFrame(s);
+}
+
+void TangramMap::clearBatch() {
+    MapState& s = *m_state;
+    s.batchViews.clear();
+    s.batchNext = 0;
+    s.batchPending = false;
+    s.batchNoLookahead = false;
+}
+
+bool TangramMap::addBatchView(double lng, double lat, float zoom, float rotation, float tilt, int width, int height) {
+    MapState& s = *m_state;
+    if (!s.map) { return false; }
+
+    makeCurrentGL(s.context);
+    if (width > 0 && height > 0 && !isHeadless() &&
+        (width != getWindowWidth() || height != getWindowHeight())) {
+        LOGE("Batch view of %dx%d on a %dx%d window, only headless maps render other sizes",
+             width, height, getWindowWidth(), getWindowHeight());
+        return false;
+    }
+
+    s.batchViews.push_back({ lng, lat, zoom, rotation, tilt, width, height });
+    return true;
+}
+
+std::shared_ptr<const PixelFrame> TangramMap::renderNextView(int lookahead, int maxFrames) {
+    MapState& s = *m_state;
+    if (!s.map) { return nullptr; }
+
+    makeCurrentGL(s.context);
+    if (!isGL()) { return nullptr; }
+
+    // The last view is read back once nothing is left to render meanwhile
+    if (s.batchNext >= s.batchViews.size()) {
+        if (!s.batchPending) { return nullptr; }
+        s.batchPending = false;
+        return s.frameReader.read(s.batchPendingIndex);
+    }
+
+    // Tiles of the coming views download while this one builds and renders,
+    // the current view's requests still come first. Tile sources are learned
+    // from the first requests of the scene, so this starts with a later view
+    bool prefetch = lookahead > 0 && canUrlPrefetch();
+    if (lookahead > 0 && !prefetch && !s.batchNoLookahead && (!hasUrlCache() || s.batchNext > 0)) {
+        LOGW("No lookahead for the batch: %s", hasUrlCache()
+             ? "no tile source known from the scene's requests yet"
+             : "prefetching needs a cachePath in init()");
+        s.batchNoLookahead = true;
+    }
+    if (prefetch) {
+        std::vector<TileCoord> upcoming;
+        size_t end = std::min(s.batchViews.size(), s.batchNext + 1 + std::max(0, lookahead));
+        for (size_t i = s.batchNext + 1; i < end; i++) {
+            const BatchView& next = s.batchViews[i];
+            int width = next.width > 0 ? next.width : getWindowWidth();
+            int height = next.height > 0 ? next.height : getWindowHeight();
+            std::vector<TileCoord> tiles = tilesInView(next.lng, next.lat, next.zoom, next.rotation, next.tilt,
+                                                       width, height);
+            upcoming.insert(upcoming.end(), tiles.begin(), tiles.end());
+        }
+        if (!upcoming.empty()) {
+            startUrlPrefetch(std::move(upcoming), UINT64_MAX);
+        }
+    }
+
+    const BatchView& view = s.batchViews[s.batchNext++];
+
+    // Offscreen only, addBatchView() keeps other sizes off windows
+    if (view.width > 0 && view.height > 0 && isHeadless() &&
+        (view.width != getWindowWidth() || view.height != getWindowHeight())) {
+        setWindowSize(view.width, view.height);
+    }
+
+    s.map->setPosition(view.lng, view.lat);
+    s.map->setZoom(view.zoom);
+    s.map->setRotation(view.rotation);
+    s.map->setTilt(view.tilt);
+    s.bDirty = true;
+
+    // Captures of every frame would push the pending view out of the ring
+    bool frameCapture = s.frameCapture;
+    s.frameCapture = false;
+
+    // update() is true once every tile of the view is loaded and drawn
+    for (int frame = 0; frame < std::max(1, maxFrames); frame++) {
+        if (update()) { break; }
+    }
+
+    s.frameCapture = frameCapture;
+    if (!s.map) { return nullptr; }
+
+    // GLES2 reads synchronously anyway
+    if (!s.frameReader.isAsync()) {
+        return readCurrentFrame(s);
+    }
+
+    // The copy of this view runs while the next one builds and renders, its
+    // pixels are returned by the next call
+    #ifndef PLATFORM_RPI
+    if (!isHeadless()) { glReadBuffer(GL_FRONT); }
+    #endif
+
+    s.frameReader.capture(s.frameIndex, getWindowWidth(), getWindowHeight());
+
+    #ifndef PLATFORM_RPI
+    if (!isHeadless()) { glReadBuffer(GL_BACK); }
+    #endif
+
+    bool hadPending = s.batchPending;
+    uint64_t previous = s.batchPendingIndex;
+    s.batchPending = true;
+    s.batchPendingIndex = s.frameIndex;
+
+    if (hadPending) {
+        return s.frameReader.read(previous);
+    }
+    // Nothing finished yet on the first view, go on with the next one
+    return renderNextView(lookahead, maxFrames);
+}
+
+float TangramMap::getPixelScale() {
+    if (m_state->map) {
+        return m_state->map->getPixelScale();
     } else {
         return 0.0;
     }
 }
 
-int getViewportHeight() {
-    if (map) {
-        return map->getViewportHeight();
+int TangramMap::getViewportHeight() {
+    if (m_state->map) {
+        return m_state->map->getViewportHeight();
     } else {
         return 0.0;
     }
 }
 
-int getViewportWidth() {
-    if (map) {
-        return map->getViewportWidth();
+int TangramMap::getViewportWidth() {
+    if (m_state->map) {
+        return m_state->map->getViewportWidth();
     } else {
         return 0.0;
     }
 }
 
-void setPosition(double _lng, double _lat) {
-    if (map) {
-        map->setPosition(_lng,_lat);
+void TangramMap::setPosition(double _lng, double _lat) {
+    if (m_state->map) {
+        m_state->map->setPosition(_lng,_lat);
+        m_state->bDirty = true;
     }
 }
 
-void setPositionEased(double _lng, double _lat, float _duration, EaseType _e) {
-    if (map) {
-        map->setPositionEased(_lng, _lat, _duration, Tangram::EaseType(_e));
+void TangramMap::setPositionEased(double _lng, double _lat, float _duration, EaseType _e) {
+    if (m_state->map) {
+        m_state->map->setPositionEased(_lng, _lat, _duration, Tangram::EaseType(_e));
+        m_state->bDirty = true;
     }
 }
 
-void setPosition(LngLat _lngLat) {
-    if (map) {
-        map->setPosition(_lngLat.lng, _lngLat.lat);
-    }
+void TangramMap::setPosition(LngLat _lngLat) {
+    setPosition(_lngLat.lng, _lngLat.lat);
 }
 
-void setPositionEased(LngLat _lngLat, float _duration, EaseType _e) {
-    map->setPositionEased(_lngLat.lng, _lngLat.lat, _duration, Tangram::EaseType(_e));
+void TangramMap::setPositionEased(LngLat _lngLat, float _duration, EaseType _e) {
+    setPositionEased(_lngLat.lng, _lngLat.lat, _duration, _e);
 }
 
-LngLat getPosition() {
+LngLat TangramMap::getPosition() {
     LngLat rta;
-    if (map) {
-        map->getPosition(rta.lng,rta.lat);
+    if (m_state->map) {
+        m_state->map->getPosition(rta.lng,rta.lat);
     }
     return rta;
 }
 
-LngLat screenPositionToLngLat(double _x, double _y) {
+LngLat TangramMap::screenPositionToLngLat(double _x, double _y) {
     LngLat rta;
-    if (map) {
-        map->screenPositionToLngLat(_x,_y, &rta.lng, &rta.lat);
+    if (m_state->map) {
+        m_state->map->screenPositionToLngLat(_x,_y, &rta.lng, &rta.lat);
     }
     return rta;
 }
 
-PointXY lngLatToScreenPosition(double _lng, double _lat) {
+PointXY TangramMap::lngLatToScreenPosition(double _lng, double _lat) {
     PointXY rta;
-    if (map) {
-        map->screenPositionToLngLat(_lng,_lat, &rta.x, &rta.y);
+    if (m_state->map) {
+        m_state->map->screenPositionToLngLat(_lng,_lat, &rta.x, &rta.y);
     }
     return rta;
 }
-PointXY lngLatToScreenPosition(LngLat _lngLat) {
-    if (map) {
-        return lngLatToScreenPosition(_lngLat.lng, _lngLat.lat);
+
+PointXY TangramMap::lngLatToScreenPosition(LngLat _lngLat) {
+    return lngLatToScreenPosition(_lngLat.lng, _lngLat.lat);
+}
+
+void TangramMap::setZoom(float _z) {
+    if (m_state->map) {
+        m_state->map->setZoom(_z);
+        m_state->bDirty = true;
+    }
+}
+
+void TangramMap::setZoomEased(float _z, float _duration, EaseType _e) {
+    if (m_state->map) {
+        m_state->map->setZoomEased(_z, _duration, Tangram::EaseType(_e));
+        m_state->bDirty = true;
+    }
+}
+
+float TangramMap::getZoom() {
+    if (m_state->map) {
+        return m_state->map->getZoom();
     } else {
-        PointXY rta;
-        return rta;
+        return 0.0;
     }
 }
 
-void setZoom(float _z) {
-    if (map) {
-        map->setZoom(_z);
+void TangramMap::setRotation(float _radians) {
+    if (m_state->map) {
+        m_state->map->setRotation(_radians);
+        m_state->bDirty = true;
     }
 }
 
-void setZoomEased(float _z, float _duration, EaseType _e) {
-    if (map) {
-        map->setZoomEased(_z, _duration, Tangram::EaseType(_e));
+void TangramMap::setRotationEased(float _radians, float _duration, EaseType _e) {
+    if (m_state->map) {
+        m_state->map->setRotationEased(_radians, _duration, Tangram::EaseType(_e));
+        m_state->bDirty = true;
     }
 }
 
-float getZoom() {
-    if (map) {
-        return map->getZoom();
+float TangramMap::getRotation() {
+    if (m_state->map) {
+        return m_state->map->getRotation();
     } else {
         return 0.0;
     }
 }
 
+void TangramMap::setTilt(float _radians) {
+    if (m_state->map) {
+        m_state->map->setTilt(_radians);
+        m_state->bDirty = true;
+    }
+}
+
+void TangramMap::setTiltEased(float _radians, float _duration, EaseType _e) {
+    if (m_state->map) {
+        m_state->map->setTiltEased(_radians, _duration, Tangram::EaseType(_e));
+        m_state->bDirty = true;
+    }
+}
+
+float TangramMap::getTilt() {
+    if (m_state->map) {
+        return m_state->map->getTilt();
+    } else {
+        return 0.;
+    }
+}
+
+void TangramMap::setCameraType(int _type) {
+    if (m_state->map) {
+        m_state->map->setCameraType(_type);
+        m_state->bDirty = true;
+    }
+}
+
+int TangramMap::getCameraType() {
+    if (m_state->map) {
+        return m_state->map->getCameraType();
+    } else {
+        return -1;
+    }
+}
+
+void TangramMap::setPixelScale(float _pixelsPerPoint) {
+    if (m_state->map) {
+        m_state->map->setPixelScale(_pixelsPerPoint);
+        m_state->bDirty = true;
+    }
+}
+
+// Module functions, on the map of init()
+//----------------------------------------------------
+
+void init(int width, int height, char * style, int maxActiveRequests, int maxHostConnections,
+          char * cachePath, int cacheSizeMB, bool headless) {
+    if (defaultMap) {
+        close();
+    }
+
+    UrlClient::Options urlOptions;
+    urlOptions.maxActiveTransfers = std::max(1, maxActiveRequests);
+    urlOptions.maxTotalConnections = urlOptions.maxActiveTransfers;
+    urlOptions.maxHostConnections = std::max(1, maxHostConnections);
+
+    if (!acquireNetwork(urlOptions)) {
+        LOGW("Network already started by another map, its options are kept");
+    } else if (cachePath && cachePath[0] != '\0') {
+        initUrlCache(cachePath, uint64_t(std::max(0, cacheSizeMB)) * 1024 * 1024);
+    }
+    defaultNetwork = true;
+
+    defaultMap = new TangramMap(width, height, style, headless);
+}
+
+void setFontCacheFile(char * path) {
+    initFontCache(path ? path : "");
+}
+
+void setFontFallbackLanguages(char * languages) {
+    std::vector<std::string> list;
+    std::string all = languages ? languages : "";
+    size_t start = 0;
+    while (start <= all.size()) {
+        size_t end = std::min(all.find(',', start), all.size());
+        std::string lang = all.substr(start, end - start);
+        lang.erase(0, lang.find_first_not_of(' '));
+        lang.erase(lang.find_last_not_of(' ') + 1);
+        if (!lang.empty()) { list.push_back(lang); }
+        start = end + 1;
+    }
+    ::setFontFallbackLanguages(list);
+}
+
+void preloadFontFallbacks() {
+    loadFontFallbacksAsync();
+}
+
+void setFrameCapture(bool enabled) {
+    if (defaultMap) {
+        defaultMap->setFrameCapture(enabled);
+    }
+}
+
+std::shared_ptr<const PixelFrame> readPixels() {
+    if (defaultMap) {
+        return defaultMap->readPixels();
+    }
+    return nullptr;
+}
+
+bool isRunning() {
+    return defaultMap && defaultMap->isRunning();
+}
+
+void loadScene(char * style, bool _useScenePosition) {
+    if (defaultMap) {
+        defaultMap->loadScene(style, _useScenePosition);
+    }
+}
+
+void loadSceneAsync(char * style, bool _useScenePosition) {
+    if (defaultMap) {
+        defaultMap->loadSceneAsync(style, _useScenePosition);
+    }
+}
+
+void queueSceneUpdate(const char* _path, const char* _value) {
+    if (defaultMap) {
+        defaultMap->queueSceneUpdate(_path, _value);
+    }
+}
+
+void applySceneUpdates() {
+    if (defaultMap) {
+        defaultMap->applySceneUpdates();
+    }
+}
+
+bool update() {
+    if (defaultMap) {
+        return defaultMap->update();
+    }
+    return false;
+}
+
+bool wasFrameRendered() {
+    return defaultMap && defaultMap->wasFrameRendered();
+}
+
+void setTargetFps(double fps) {
+    if (defaultMap) {
+        defaultMap->setTargetFps(fps);
+    }
+}
+
+void setVsync(bool enabled) {
+    if (defaultMap) {
+        defaultMap->setVsync(enabled);
+    }
+}
+
+void setPacingStrategy(PacingStrategy strategy) {
+    if (defaultMap) {
+        defaultMap->setPacingStrategy(strategy);
+    }
+}
+
+double getFrameTimeLeft() {
+    return defaultMap ? defaultMap->getFrameTimeLeft() : 0.0;
+}
+
+Distribution getFrameStats(FramePhase phase) {
+    return defaultMap ? defaultMap->getFrameStats(phase) : Distribution();
+}
+
+void resetFrameStats() {
+    if (defaultMap) {
+        defaultMap->resetFrameStats();
+    }
+}
+
+void startTrace() {
+    startTracing();
+}
+
+bool stopTrace(char * path) {
+    return stopTracing(path ? path : "");
+}
+
+void setLogLevel(LogSeverity severity) {
+    setLoggerLevel(LogLevel(severity));
+}
+
+void flushLog(double timeout) {
+    flushLogger(timeout);
+}
+
+void close() {
+    if (defaultMap) {
+        delete defaultMap;
+        defaultMap = nullptr;
+    }
+
+    if (defaultNetwork) {
+        releaseNetwork();
+        defaultNetwork = false;
+    }
+}
+
+NetworkStats getNetworkStats() {
+    UrlClient::Stats stats = getUrlRequestStats();
+
+    NetworkStats rta;
+    rta.cancelled = stats.cancelled;
+    rta.cancelledBytes = stats.cancelledBytes;
+    rta.connectionsReused = stats.connectionsReused;
+    rta.connectionsNew = stats.connectionsNew;
+
+    // Microseconds to milliseconds
+    rta.queueWait = distribution(stats.queueWait, 1e-3);
+    rta.dns = distribution(stats.dns, 1e-3);
+    rta.connect = distribution(stats.connect, 1e-3);
+    rta.tls = distribution(stats.tls, 1e-3);
+    rta.ttfb = distribution(stats.ttfb, 1e-3);
+    rta.total = distribution(stats.total, 1e-3);
+    rta.bytes = distribution(stats.bytes, 1);
+    return rta;
+}
+
+CacheStats getCacheStats() {
+    DiskCache::Stats stats = getUrlCacheStats();
+
+    CacheStats rta;
+    rta.hits = stats.hits;
+    rta.misses = stats.misses;
+    rta.revalidated = stats.revalidated;
+    rta.entries = stats.entries;
+    rta.bytes = stats.bytes;
+
+    MemoryCache::Stats memoryStats = getUrlMemoryCacheStats();
+    rta.memoryHits = memoryStats.hits;
+    rta.memoryBytes = memoryStats.bytes;
+    return rta;
+}
+
+void setMemoryCacheSize(int sizeMB) {
+    setUrlMemoryCacheSize(size_t(std::max(0, sizeMB)) * 1024 * 1024);
+}
+
+void setNetworkLimits(int maxHostRequests, int maxKBps) {
+    setUrlRequestLimits(uint32_t(std::max(0, maxHostRequests)), uint64_t(std::max(0, maxKBps)) * 1024);
+}
+
+bool setNetworkLog(char * path) {
+    return setUrlRequestLog(path ? path : "");
+}
+
+bool prefetchBounds(double minLng, double minLat, double maxLng, double maxLat,
+                    int minZoom, int maxZoom, int maxMB) {
+    std::vector<TileCoord> tiles;
+    for (int z = std::max(0, minZoom); z <= maxZoom; z++) {
+        std::vector<TileCoord> level = tilesInBounds(minLng, minLat, maxLng, maxLat, z);
+        tiles.insert(tiles.end(), level.begin(), level.end());
+    }
+    return startUrlPrefetch(std::move(tiles), uint64_t(std::max(0, maxMB)) * 1024 * 1024);
+}
+
+bool prefetchRoute(std::vector<std::pair<double, double>> route, int minZoom, int maxZoom,
+                   int radius, int maxMB) {
+    std::vector<TileCoord> tiles = tilesAlongRoute(route, minZoom, maxZoom, std::max(0, radius));
+    return startUrlPrefetch(std::move(tiles), uint64_t(std::max(0, maxMB)) * 1024 * 1024);
+}
+
+void addPrefetchSource(char * urlTemplate) {
+    addUrlPrefetchTemplate(urlTemplate);
+}
+
+PrefetchProgress getPrefetchProgress() {
+    Prefetcher::Progress progress = getUrlPrefetchProgress();
+
+    PrefetchProgress rta;
+    rta.total = progress.total;
+    rta.done = progress.done;
+    rta.cached = progress.cached;
+    rta.failed = progress.failed;
+    rta.bytes = progress.bytes;
+    rta.running = progress.running;
+    return rta;
+}
+
+void cancelPrefetch() {
+    cancelUrlPrefetch();
+}
+
+void clearBatch() {
+    if (defaultMap) {
+        defaultMap->clearBatch();
+    }
+}
+
+bool addBatchView(double lng, double lat, float zoom, float rotation, float tilt, int width, int height) {
+    if (defaultMap) {
+        return defaultMap->addBatchView(lng, lat, zoom, rotation, tilt, width, height);
+    }
+    return false;
+}
+
+std::shared_ptr<const PixelFrame> renderNextView(int lookahead, int maxFrames) {
+    if (defaultMap) {
+        return defaultMap->renderNextView(lookahead, maxFrames);
+    }
+    return nullptr;
+}
+
+float getPixelScale() {
+    return defaultMap ? defaultMap->getPixelScale() : 0.0;
+}
+
+int getViewportHeight() {
+    return defaultMap ? defaultMap->getViewportHeight() : 0;
+}
+
+int getViewportWidth() {
+    return defaultMap ? defaultMap->getViewportWidth() : 0;
+}
+
+void setPosition(double _lng, double _lat) {
+    if (defaultMap) {
+        defaultMap->setPosition(_lng, _lat);
+    }
+}
+
+void setPositionEased(double _lng, double _lat, float _duration, EaseType _e) {
+    if (defaultMap) {
+        defaultMap->setPositionEased(_lng, _lat, _duration, _e);
+    }
+}
+
+void setPosition(LngLat _lngLat) {
+    if (defaultMap) {
+        defaultMap->setPosition(_lngLat);
+    }
+}
+
+void setPositionEased(LngLat _lngLat, float _duration, EaseType _e) {
+    if (defaultMap) {
+        defaultMap->setPositionEased(_lngLat, _duration, _e);
+    }
+}
+
+LngLat getPosition() {
+    return defaultMap ? defaultMap->getPosition() : LngLat();
+}
+
+LngLat screenPositionToLngLat(double _x, double _y) {
+    return defaultMap ? defaultMap->screenPositionToLngLat(_x, _y) : LngLat();
+}
+
+PointXY lngLatToScreenPosition(double _lng, double _lat) {
+    return defaultMap ? defaultMap->lngLatToScreenPosition(_lng, _lat) : PointXY();
+}
+
+PointXY lngLatToScreenPosition(LngLat _lngLat) {
+    return defaultMap ? defaultMap->lngLatToScreenPosition(_lngLat) : PointXY();
+}
+
+void setZoom(float _z) {
+    if (defaultMap) {
+        defaultMap->setZoom(_z);
+    }
+}
+
+void setZoomEased(float _z, float _duration, EaseType _e) {
+    if (defaultMap) {
+        defaultMap->setZoomEased(_z, _duration, _e);
+    }
+}
+
+float getZoom() {
+    return defaultMap ? defaultMap->getZoom() : 0.0;
+}
+
 void setRotation(float _radians) {
-    if (map) {
-        map->setRotation(_radians);
+    if (defaultMap) {
+        defaultMap->setRotation(_radians);
     }
 }
 
 void setRotationEased(float _radians, float _duration, EaseType _e) {
-    if (map) {
-        map->setRotationEased(_radians, _duration, Tangram::EaseType(_e));
+    if (defaultMap) {
+        defaultMap->setRotationEased(_radians, _duration, _e);
     }
 }
 
 float getRotation() {
-    if (map) {
-        return map->getRotation();
-    } else {
-        return 0.0;
-    }
+    return defaultMap ? defaultMap->getRotation() : 0.0;
 }
 
 void setTilt(float _radians) {
-    if (map) {
-        map->setTilt(_radians);
+    if (defaultMap) {
+        defaultMap->setTilt(_radians);
     }
 }
 
 void setTiltEased(float _radians, float _duration, EaseType _e) {
-    if (map) {
-        map->setTiltEased(_radians, _duration, Tangram::EaseType(_e));
+    if (defaultMap) {
+        defaultMap->setTiltEased(_radians, _duration, _e);
     }
 }
 
 float getTilt() {
-    if (map) {
-        return map->getTilt();
-    } else {
-        return 0.;
-    }
+    return defaultMap ? defaultMap->getTilt() : 0.;
 }
 
 void setCameraType(int _type) {
-    if (map) {
-        map->setCameraType(_type);
+    if (defaultMap) {
+        defaultMap->setCameraType(_type);
     }
 }
 
 int getCameraType() {
-    if (map) {
-        return map->getCameraType();
-    } else {
-        return -1;
-    }
+    return defaultMap ? defaultMap->getCameraType() : -1;
 }
 
 void setPixelScale(float _pixelsPerPoint) {
-    if (map) {
-        map->setPixelScale(_pixelsPerPoint);
+    if (defaultMap) {
+        defaultMap->setPixelScale(_pixelsPerPoint);
     }
 }
 
+// Events of a context, for the map it was created for
+//----------------------------------------------------
+
 void onKeyPress(int _key) {
-    if (map) {
-        keyPressed = _key;
+    MapState* s = eventMap();
+    if (s) {
+        s->bDirty = true;
+        Tangram::Map* map = s->map;
+        s->keyPressed = _key;
         switch (_key) {
             case KEY_ZOOM_IN:
                 map->handlePinchGesture(0.0,0.0,0.5,0.0);
@@ -307,7 +1078,7 @@ void onKeyPress(int _key) {
                 map->handlePanGesture(0.0,0.0,-100.0,0.0);
                 break;
             case KEY_ESC:
-                close();
+                s->bClosing = true;
                 break;
         }
     }
@@ -318,14 +1089,21 @@ void onMouseMove(float _x, float _y) {
 }
 
 void onMouseClick(float _x, float _y, int _button) {
+    MapState* s = eventMap();
+    if (!s) { return; }
+
+    // Picking happens while rendering
+    s->bDirty = true;
+
     double time = getTime();
 
-    if (map && (time - last_time_released) < double_tap_time) {
+    if ((time - s->last_time_released) < double_tap_time) {
+        Tangram::Map* map = s->map;
         Tangram::LngLat p;
         map->screenPositionToLngLat(_x, _y, &p.longitude, &p.latitude);
 
         logMsg("pick feature\n");
-        map->clearDataSource(*data_source, true, true);
+        map->clearDataSource(*s->data_source, true, true);
 
         map->pickFeatureAt(_x, _y, [](auto item) {
             if (!item) { return; }
@@ -336,34 +1114,39 @@ void onMouseClick(float _x, float _y, int _button) {
         });
     }
 
-    last_time_released = time;
+    s->last_time_released = time;
 }
 
 void onScroll(float _x, float _y, float _scrollx, float _scrolly, ScrollType _type) {
-    if (map) {
+    MapState* s = eventMap();
+    if (s) {
+        s->bDirty = true;
         if (_type == SHOVE) {
-            map->handleShoveGesture(scroll_distance_multiplier * _scrolly);
+            s->map->handleShoveGesture(scroll_distance_multiplier * _scrolly);
         } else if (_type == ROTATE) {
-            map->handleRotateGesture(_x, _y, scroll_span_multiplier * _scrolly);
+            s->map->handleRotateGesture(_x, _y, scroll_span_multiplier * _scrolly);
         } else {
-            map->handlePinchGesture(_x, _y, 1.0 + scroll_span_multiplier * _scrolly, 0.f);
+            s->map->handlePinchGesture(_x, _y, 1.0 + scroll_span_multiplier * _scrolly, 0.f);
         }
     }
 }
 
 void onMouseDrag(float _x, float _y, int _button) {
-    if (map) {
+    MapState* s = eventMap();
+    if (s) {
+        s->bDirty = true;
+        Tangram::Map* map = s->map;
         if( _button == 1 ){
             map->handlePanGesture(_x - getMouseVelX(), _y + getMouseVelY(), _x, _y);
         } else if( _button == 2 ){
-            if ( keyPressed == KEY_ROTATE) {
+            if ( s->keyPressed == KEY_ROTATE) {
                 float scale = -0.05;
                 float rot = atan2(getMouseVelY(),getMouseVelX());
                 if( _x < getWindowWidth()/2.0 ) {
                     scale *= -1.0;
                 }
                 map->handleRotateGesture(getWindowWidth()/2.0, getWindowHeight()/2.0, rot*scale);
-            } else if ( keyPressed == KEY_TILT) {
+            } else if ( s->keyPressed == KEY_TILT) {
                 map->handleShoveGesture(getMouseVelY()*0.1);
             } else {
                 map->handlePinchGesture(getWindowWidth()/2.0, getWindowHeight()/2.0, 1.0 + getMouseVelY()*0.001, 0.f);
@@ -373,16 +1156,21 @@ void onMouseDrag(float _x, float _y, int _button) {
 }
 
 void onDrop(int count, const char** paths) {
-    if (map) {
-        sceneFile = std::string(paths[0]);
-        map->loadSceneAsync(sceneFile.c_str());
+    MapState* s = eventMap();
+    if (s) {
+        s->bDirty = true;
+        s->sceneFile = std::string(paths[0]);
+        clearUrlPrefetchTemplates();
+        s->map->loadSceneAsync(s->sceneFile.c_str());
     }
 }
 
 void onViewportResize(int _newWidth, int _newHeight) {
-    if (map) {
-        pixel_scale = getDevicePixelRatio();
-        map->setPixelScale(pixel_scale);
-        map->resize(getWindowWidth(), getWindowHeight());
+    MapState* s = eventMap();
+    if (s) {
+        s->bDirty = true;
+        s->pixel_scale = getDevicePixelRatio();
+        s->map->setPixelScale(s->pixel_scale);
+        s->map->resize(getWindowWidth(), getWindowHeight());
     }
 }
@@ -1,5 +1,13 @@
 #pragma once
 
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "frameReader.h"
+#include "framePacer.h"
+#include "frameTimer.h"
+
 #ifndef PYTHON_ENUM 
 #define PYTHON_ENUM(x) enum x
 #endif
@@ -11,6 +19,32 @@ PYTHON_ENUM(EaseType) {
   SINE=3
 };
 
+// Same order as FramePacer::Strategy
+PYTHON_ENUM(PacingStrategy) {
+  PACE_SLEEP=0,
+  PACE_SPIN=1,
+  PACE_HYBRID=2
+};
+
+// Same order as FrameTimer::Phase
+PYTHON_ENUM(FramePhase) {
+  PHASE_NETWORK=0,
+  PHASE_EVENTS=1,
+  PHASE_UPDATE=2,
+  PHASE_RENDER=3,
+  PHASE_SWAP=4,
+  PHASE_FRAME=5
+};
+
+// Same order as LogLevel
+PYTHON_ENUM(LogSeverity) {
+  SEVERITY_DEBUG=0,
+  SEVERITY_INFO=1,
+  SEVERITY_NOTIFY=2,
+  SEVERITY_WARNING=3,
+  SEVERITY_ERROR=4
+};
+
 struct LngLat {
     double lng;
     double lat;
@@ -21,10 +55,168 @@ struct PointXY {
     double y;
 };
 
-void init(int width, int height, char * style = "scene.yaml");
+struct CacheStats {
+    long hits;          // responses served fresh from the disk cache
+    long misses;        // responses fetched from the network
+    long revalidated;   // misses answered with 304 Not Modified
+    long entries;
+    long bytes;
+    long memoryHits;    // responses served from the in-memory LRU
+    long memoryBytes;
+};
+
+// Distribution of a measure over finished transfers or frames
+struct Distribution {
+    long count;
+    double mean;
+    double p50;
+    double p95;
+    double p99;
+    double max;
+};
+
+struct NetworkStats {
+    long cancelled;         // transfers aborted while running
+    long cancelledBytes;    // bytes not downloaded thanks to those aborts
+    long connectionsReused; // transfers served over an already open connection
+    long connectionsNew;    // connections opened, each with DNS lookup and handshake
+
+    // In milliseconds, dns, connect and tls only for new connections
+    Distribution queueWait; // waiting in the request queue
+    Distribution dns;
+    Distribution connect;
+    Distribution tls;
+    Distribution ttfb;      // from the start of the transfer to the first byte
+    Distribution total;     // from the start of the transfer to its end
+    Distribution bytes;     // response size in bytes
+};
+
+struct PrefetchProgress {
+    long total;     // tile urls to prefetch
+    long done;      // fetched, failed or already cached
+    long cached;    // already fresh in the disk cache
+    long failed;
+    long bytes;     // downloaded so far
+    bool running;
+};
+
+struct MapState;
+
+// A map with its own GL context, scene and camera. Headless maps can be used
+// side by side, each on a thread of its own; windowed maps must all be
+// created, updated and closed on the main thread, whose updates also handle
+// the events of the other windows. A map is used and closed by the thread
+// that created it. URL
+// requests, caches and fonts are shared by all maps and started with the
+// first one; init() configures them when it comes first
+class TangramMap {
+
+public:
+
+    TangramMap(int width, int height, char * style = "scene.yaml", bool headless = false);
+    ~TangramMap();
+
+    TangramMap(const TangramMap&) = delete;
+    TangramMap& operator=(const TangramMap&) = delete;
+
+    bool isRunning();
+    void close();
+
+    void loadScene(char * style, bool _useScenePosition = false);
+    void loadSceneAsync(char * style, bool _useScenePosition = false);
+    void queueSceneUpdate(const char* _path, const char* _value);
+    void applySceneUpdates();
+    bool update();
+    bool wasFrameRendered();
+
+    void setTargetFps(double fps);
+    void setVsync(bool enabled);
+    void setPacingStrategy(PacingStrategy strategy);
+    double getFrameTimeLeft();
+
+    Distribution getFrameStats(FramePhase phase);
+    void resetFrameStats();
+
+    void setFrameCapture(bool enabled);
+    std::shared_ptr<const PixelFrame> readPixels();
+
+    void clearBatch();
+    bool addBatchView(double lng, double lat, float zoom, float rotation = 0, float tilt = 0,
+                      int width = 0, int height = 0);
+    std::shared_ptr<const PixelFrame> renderNextView(int lookahead = 4, int maxFrames = 600);
+
+    void setPixelScale(float _pixelsPerPoint);
+    float getPixelScale();
+    int getViewportHeight();
+    int getViewportWidth();
+
+    void setPosition(double _lon, double _lat);
+    void setPositionEased(double _lon, double _lat, float _duration, EaseType _e = QUINT);
+    void setPosition(LngLat _lngLat);
+    void setPositionEased(LngLat _lngLat, float _duration, EaseType _e = QUINT);
+    LngLat getPosition();
+
+    LngLat screenPositionToLngLat(double _x, double _y);
+    PointXY lngLatToScreenPosition(double _lng, double _lat);
+    PointXY lngLatToScreenPosition(LngLat _lngLat);
+
+    void setZoom(float _z);
+    void setZoomEased(float _z, float _duration, EaseType _e = QUINT);
+    float getZoom();
+
+    void setRotation(float _radians);
+    void setRotationEased(float _radians, float _duration, EaseType _e = QUINT);
+    float getRotation();
+
+    void setTilt(float _radians);
+    void setTiltEased(float _radians, float _duration, EaseType _e = QUINT);
+    float getTilt();
+
+    void setCameraType(int _type);
+    int getCameraType();
+
+private:
+
+    MapState* m_state;
+};
+
+// The module functions below drive a single map, created by init()
+
+// Create the GL context and the map. maxActiveRequests bounds the number of
+// URL transfers running at once and maxHostConnections the number of
+// connections opened to a single tile host. When cachePath is set, HTTP
+// responses are kept there across runs, using up to cacheSizeMB of disk.
+// A headless map opens no window: it renders offscreen at width x height,
+// e.g. on servers without display
+void init(int width, int height, char * style = "scene.yaml",
+          int maxActiveRequests = 32, int maxHostConnections = 6,
+          char * cachePath = "", int cacheSizeMB = 256, bool headless = false);
+
+// Remember system font matches in a file so that later runs skip fontconfig
+// matching; call before init(). New matches are written once a view has
+// finished loading and at exit. The file is ignored once fonts are added or
+// removed
+void setFontCacheFile(char * path);
+
+// Comma separated languages (e.g. "en,ja,ar") whose fallback fonts are tried
+// first for glyphs the scene fonts lack; call before init()
+void setFontFallbackLanguages(char * languages);
+// Match the fallback fonts of all languages in the background, otherwise
+// each one is matched when a label first needs it
+void preloadFontFallbacks();
 
 bool isRunning();
 
+// Read back every frame rendered by update(), the copy of one frame runs
+// while the next renders. Needed to read windowed frames on the RPi
+void setFrameCapture(bool enabled);
+
+// Pixels of the last frame as a read-only buffer: numpy.asarray(frame) is a
+// height x width x 4 RGBA array, top row first, sharing its memory. With
+// frame capture on it is the frame before the last one (see frame.index),
+// whose copy is already done; otherwise the framebuffer is read now
+std::shared_ptr<const PixelFrame> readPixels();
+
 // Load the scene at the given absolute file path synchronously
 void loadScene(char * style, bool _useScenePosition = false);
 // Load the scene at the given absolute file path asynchronously
@@ -39,10 +231,93 @@ void applySceneUpdates();
 
 // Update the map state with the time interval since the last update, returns
 // true when the current view is completely loaded (all tiles are available and
-// no animation in progress)
+// no animation in progress). A frame is only drawn when the view changed,
+// input arrived, tiles or animations are in progress or a render was
+// requested; otherwise update() waits up to a quarter second for one of those
 bool update();
+// Whether the last update() drew and presented a frame
+bool wasFrameRendered();
+
+// Frame pacing: update() holds a frame back until fps frames per second are
+// kept, 0 (the default) does not limit them. Vsync, on by default for
+// windows, additionally waits for the display on every swap; turn it off
+// with fps 0 to benchmark. PACE_SLEEP saves power, PACE_SPIN is exact and
+// PACE_HYBRID (the default) sleeps, then spins the last 1.5 ms
+void setTargetFps(double fps);
+void setVsync(bool enabled);
+void setPacingStrategy(PacingStrategy strategy);
+// Seconds until the next frame is due, the budget left for work in Python
+// between two update() calls
+double getFrameTimeLeft();
+
+// Durations in milliseconds of a phase of update() over the last 512 frames:
+// URL queue dispatch, input polling, Map::update(), Map::render(), buffer
+// swap, or the whole frame. Idle waits and pacing are left out, and only
+// updates that drew a frame count, the same ones for every phase
+Distribution getFrameStats(FramePhase phase);
+void resetFrameStats();
+
+// Record what every thread does, from update() phases to URL transfers and
+// their callbacks, until stopTrace() writes it as Chrome trace-event JSON
+// for chrome://tracing or ui.perfetto.dev
+void startTrace();
+bool stopTrace(char * path);
+
+// Log messages are written to stderr by a background thread, or passed to
+// the function given to setLogCallback(severity, message) there. Messages
+// below severity are discarded
+void setLogLevel(LogSeverity severity);
+// Wait until the messages logged so far are written
+void flushLog(double timeout = 1.0);
+
 void close();
 
+// Get the counters of the URL request layer
+NetworkStats getNetworkStats();
+// Get the hit and miss counters of the response caches
+CacheStats getCacheStats();
+// Set the budget of the in-memory cache of recent responses (default 16 MB)
+void setMemoryCacheSize(int sizeMB);
+// Limit the URL transfers running at once to a single host and the download
+// rate of all transfers together, 0 removes a limit. Queued requests keep
+// starting in priority order within these limits
+void setNetworkLimits(int maxHostRequests, int maxKBps);
+// Append one JSON line with the timings of every finished transfer to path,
+// an empty path stops logging
+bool setNetworkLog(char * path);
+
+// Download the tiles of an area, or of a route given as (lng, lat) pairs, for
+// zooms minZoom to maxZoom into the disk cache at low priority, stopping after
+// maxMB. Tile sources are learned from the requests of the scene, so load it
+// first; loading another scene forgets them and cancels the prefetch.
+// Returns false without a cachePath or a known tile source
+bool prefetchBounds(double minLng, double minLat, double maxLng, double maxLat,
+                    int minZoom, int maxZoom, int maxMB = 256);
+bool prefetchRoute(std::vector<std::pair<double, double>> route, int minZoom, int maxZoom,
+                   int radius = 1, int maxMB = 256);
+// Prefetch from a URL template with {z}, {x} and {y} placeholders as well
+void addPrefetchSource(char * urlTemplate);
+PrefetchProgress getPrefetchProgress();
+void cancelPrefetch();
+
+// Batch rendering of static maps, see renderBatch() in Python. Views are
+// queued with their size in pixels (0 keeps the current size) and angles
+// in radians. Only headless maps render views at sizes of their own: a
+// window cannot be read back beyond its drawable, so addBatchView() refuses
+// sizes other than the window's and returns false
+void clearBatch();
+bool addBatchView(double lng, double lat, float zoom, float rotation = 0, float tilt = 0,
+                  int width = 0, int height = 0);
+// Render the next queued view until its tiles are loaded, or maxFrames
+// updates, and return the pixels of the views in order; None once all were
+// returned. Each view is read back while the following one renders, so a
+// call returns the view before the one it rendered. Meanwhile the tiles of
+// the following lookahead views are prefetched, so downloads overlap
+// building and rendering. Without a cachePath, or before the scene's first
+// tile request showed its tile source, there is no lookahead: a warning is
+// logged once per batch
+std::shared_ptr<const PixelFrame> renderNextView(int lookahead = 4, int maxFrames = 600);
+
 // Set the ratio of hardware pixels to logical pixels (defaults to 1.0);
 // this operation can be slow, so only perform this when necessary.
 void setPixelScale(float _pixelsPerPoint);
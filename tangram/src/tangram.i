@@ -1,4 +1,4 @@
-%module tangram
+%module(threads="1") tangram
 %{
     #define SWIG_FILE_WITH_INIT
     #include "src/tangram-proxy.h"
@@ -19,4 +19,212 @@
         %} \
         enum x
 
+// Allow init(800, 600, style, maxActiveRequests=64) from Python
+%feature("compactdefaultargs") init;
+%feature("kwargs") init;
+%feature("compactdefaultargs") addBatchView;
+%feature("kwargs") addBatchView;
+%feature("compactdefaultargs") TangramMap::TangramMap;
+%feature("kwargs") TangramMap::TangramMap;
+%feature("compactdefaultargs") TangramMap::addBatchView;
+%feature("kwargs") TangramMap::addBatchView;
+
+// Maps on other threads keep running while one updates or reads pixels
+%nothread;
+%thread update;
+%thread readPixels;
+%thread renderNextView;
+%thread stopTrace;
+%thread flushLog;
+%thread TangramMap::TangramMap;
+%thread TangramMap::update;
+%thread TangramMap::readPixels;
+%thread TangramMap::renderNextView;
+
+// Routes for prefetchRoute() as lists of (lng, lat) tuples
+%include "std_pair.i"
+%include "std_vector.i"
+%template(LngLatPair) std::pair<double, double>;
+%template(Route) std::vector<std::pair<double, double> >;
+
+// readPixels() returns a Frame supporting the buffer protocol, holding the
+// pixels as long as Python references them
+%{
+typedef struct {
+    PyObject_HEAD
+    std::shared_ptr<const PixelFrame>* frame;
+    Py_ssize_t shape[3];
+    Py_ssize_t strides[3];
+} FrameObject;
+
+static void Frame_dealloc(PyObject* _self) {
+    delete ((FrameObject*)_self)->frame;
+    Py_TYPE(_self)->tp_free(_self);
+}
+
+static int Frame_getbuffer(PyObject* _self, Py_buffer* _view, int _flags) {
+    FrameObject* self = (FrameObject*)_self;
+    const PixelFrame& frame = **self->frame;
+
+    if (_flags & PyBUF_WRITABLE) {
+        PyErr_SetString(PyExc_BufferError, "Frame pixels are read-only");
+        _view->obj = NULL;
+        return -1;
+    }
+
+    _view->obj = _self;
+    Py_INCREF(_self);
+    _view->buf = (void*)frame.pixels.data();
+    _view->len = frame.pixels.size();
+    _view->readonly = 1;
+    _view->itemsize = 1;
+    _view->format = (_flags & PyBUF_FORMAT) ? (char*)"B" : NULL;
+    _view->ndim = (_flags & PyBUF_ND) ? 3 : 1;
+    _view->shape = (_flags & PyBUF_ND) ? self->shape : NULL;
+    _view->strides = ((_flags & PyBUF_STRIDES) == PyBUF_STRIDES) ? self->strides : NULL;
+    _view->suboffsets = NULL;
+    _view->internal = NULL;
+    return 0;
+}
+
+static PyObject* Frame_width(PyObject* _self, void*) {
+    return PyLong_FromLong((**((FrameObject*)_self)->frame).width);
+}
+
+static PyObject* Frame_height(PyObject* _self, void*) {
+    return PyLong_FromLong((**((FrameObject*)_self)->frame).height);
+}
+
+static PyObject* Frame_index(PyObject* _self, void*) {
+    return PyLong_FromUnsignedLongLong((**((FrameObject*)_self)->frame).index);
+}
+
+static PyGetSetDef Frame_getset[] = {
+    { (char*)"width", Frame_width, NULL, NULL, NULL },
+    { (char*)"height", Frame_height, NULL, NULL, NULL },
+    { (char*)"index", Frame_index, NULL, (char*)"update() that rendered the frame", NULL },
+    { NULL, NULL, NULL, NULL, NULL }
+};
+
+static PyBufferProcs Frame_buffer;
+static PyTypeObject FrameType = { PyVarObject_HEAD_INIT(NULL, 0) "tangram.Frame" };
+%}
+
+%init %{
+    FrameType.tp_basicsize = sizeof(FrameObject);
+    FrameType.tp_dealloc = Frame_dealloc;
+    FrameType.tp_getset = Frame_getset;
+    FrameType.tp_doc = "RGBA pixels of a rendered frame, top row first";
+    Frame_buffer.bf_getbuffer = Frame_getbuffer;
+    FrameType.tp_as_buffer = &Frame_buffer;
+#if PY_MAJOR_VERSION < 3
+    FrameType.tp_flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_NEWBUFFER;
+#else
+    FrameType.tp_flags = Py_TPFLAGS_DEFAULT;
+#endif
+    if (PyType_Ready(&FrameType) == 0) {
+        Py_INCREF(&FrameType);
+        PyDict_SetItemString(d, "Frame", (PyObject*)&FrameType);
+    }
+%}
+
+%typemap(out) std::shared_ptr<const PixelFrame> {
+    const std::shared_ptr<const PixelFrame>& frame = $1;
+    if (!frame) {
+        Py_INCREF(Py_None);
+        $result = Py_None;
+    } else {
+        FrameObject* object = PyObject_New(FrameObject, &FrameType);
+        object->frame = new std::shared_ptr<const PixelFrame>(frame);
+        object->shape[0] = frame->height;
+        object->shape[1] = frame->width;
+        object->shape[2] = 4;
+        object->strides[0] = Py_ssize_t(frame->width) * 4;
+        object->strides[1] = 4;
+        object->strides[2] = 1;
+        $result = (PyObject*)object;
+    }
+}
+
 %include "src/tangram-proxy.h"
+
+// setLogCallback(f) calls f(severity, message) on the logging thread
+%{
+#include "src/logger.h"
+
+static PyObject* logCallback = NULL;
+
+static void callLogCallback(LogLevel _level, const std::string& _message) {
+    PyGILState_STATE gil = PyGILState_Ensure();
+
+    PyObject* message = PyUnicode_DecodeUTF8(_message.data(), _message.size(), "replace");
+    PyObject* result = message ? PyObject_CallFunction(logCallback, (char*)"iO", int(_level), message) : NULL;
+    if (result) {
+        Py_DECREF(result);
+    } else {
+        PyErr_Print();
+    }
+    Py_XDECREF(message);
+
+    PyGILState_Release(gil);
+}
+%}
+
+%inline %{
+// None writes log messages to stderr again
+void setLogCallback(PyObject* callback) {
+    PyObject* previous = logCallback;
+    bool enabled = callback && callback != Py_None;
+
+    // The logging thread may be waiting for the GIL in the previous callback
+    Py_BEGIN_ALLOW_THREADS
+    setLoggerSink(nullptr);
+    Py_END_ALLOW_THREADS
+
+    if (enabled) {
+        Py_INCREF(callback);
+        logCallback = callback;
+        setLoggerSink(callLogCallback);
+    } else {
+        logCallback = NULL;
+    }
+    Py_XDECREF(previous);
+}
+%}
+
+%pythoncode %{
+import atexit
+import sys
+
+# The logging thread outlives the interpreter
+atexit.register(setLogCallback, None)
+
+def _renderBatch(target, views, lookahead, maxFrames):
+    target.clearBatch()
+    for view in views:
+        if isinstance(view, dict):
+            added = target.addBatchView(**view)
+        else:
+            added = target.addBatchView(*view)
+        if not added:
+            raise ValueError('cannot render view %r, sizes other than the window need a headless map' % (view,))
+
+    while True:
+        frame = target.renderNextView(lookahead, maxFrames)
+        if frame is None:
+            return
+        yield frame
+
+def renderBatch(views, lookahead=4, maxFrames=600):
+    """Render static maps, yielding a Frame per view. Views are tuples
+    (lng, lat, zoom[, rotation, tilt, width, height]) or dicts with those
+    keys; the tiles of the next lookahead views download meanwhile. Lookahead
+    needs a cachePath in init() and is logged as unavailable otherwise"""
+    return _renderBatch(sys.modules[__name__], views, lookahead, maxFrames)
+
+def _mapRenderBatch(self, views, lookahead=4, maxFrames=600):
+    """renderBatch() on this map"""
+    return _renderBatch(self, views, lookahead, maxFrames)
+
+TangramMap.renderBatch = _mapRenderBatch
+%}
@@ -0,0 +1,85 @@
+#include "tileArchive.h"
+#include "log.h"
+
+#include <algorithm>
+#include <cstring>
+
+#define ARCHIVE_MAGIC 0x52414754    // "TGAR"
+#define ARCHIVE_VERSION 2
+#define TILE_PRESENT 1
+#define ARCHIVE_SCHEME "archive://"
+#define MAX_ARCHIVE_ZOOM 29
+
+struct ArchiveHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t count;
+};
+
+static uint64_t tileId(const TileCoord& _tile) {
+    return (uint64_t(_tile.z) << 58) | (uint64_t(_tile.x) << 29) | uint64_t(_tile.y);
+}
+
+std::shared_ptr<TileArchive> TileArchive::open(const std::string& _path) {
+
+    auto file = FileView::open(_path);
+    if (!file || file->size() < sizeof(ArchiveHeader)) {
+        LOGW("Cannot read tile archive %s", _path.c_str());
+        return nullptr;
+    }
+
+    ArchiveHeader header;
+    memcpy(&header, file->data(), sizeof(header));
+
+    uint64_t indexEnd = sizeof(header) + header.count * sizeof(Record);
+    if (header.magic != ARCHIVE_MAGIC || header.version < 1 || header.version > ARCHIVE_VERSION ||
+        header.count > file->size() / sizeof(Record) || indexEnd > file->size()) {
+        LOGW("Invalid tile archive %s", _path.c_str());
+        return nullptr;
+    }
+
+    std::shared_ptr<TileArchive> archive(new TileArchive());
+    archive->m_file = file;
+    archive->m_index = reinterpret_cast<const Record*>(file->data() + sizeof(header));
+    archive->m_count = header.count;
+    archive->m_version = header.version;
+    return archive;
+}
+
+bool TileArchive::get(const TileCoord& _tile, std::vector<char>& _content) const {
+
+    if (_tile.z > MAX_ARCHIVE_ZOOM) { return false; }
+
+    uint64_t id = tileId(_tile);
+    const Record* end = m_index + m_count;
+    const Record* record = std::lower_bound(m_index, end, id,
+                                            [](const Record& _r, uint64_t _id) { return _r.id < _id; });
+
+    if (record == end || record->id != id) { return false; }
+
+    // Listed as missing
+    if (m_version >= 2 && !(record->flags & TILE_PRESENT)) { return false; }
+
+    if (record->offset > m_file->size() || record->length > m_file->size() - record->offset) {
+        LOGW("Tile %d/%d/%d out of archive bounds", _tile.z, _tile.x, _tile.y);
+        return false;
+    }
+
+    const char* data = m_file->data() + record->offset;
+    _content.assign(data, data + record->length);
+    return true;
+}
+
+bool parseArchiveUrl(const std::string& _url, std::string& _path, TileCoord& _tile) {
+    const size_t schemeLength = strlen(ARCHIVE_SCHEME);
+    if (_url.compare(0, schemeLength, ARCHIVE_SCHEME) != 0) { return false; }
+
+    std::string urlTemplate;
+    if (!parseTileUrl(_url, _tile) || !tileUrlTemplate(_url, urlTemplate)) { return false; }
+
+    size_t end = urlTemplate.find("/{z}/{x}/{y}");
+    if (end == std::string::npos || end <= schemeLength) { return false; }
+
+    _path = urlTemplate.substr(schemeLength, end - schemeLength);
+    return true;
+}
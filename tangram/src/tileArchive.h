@@ -0,0 +1,56 @@
+#pragma once
+
+#include "fileView.h"
+#include "tileUrl.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Read-only file holding many tiles, written by tangram/archive.py:
+//
+//   header   magic "TGAR", version, number of tiles
+//   index    one record per tile, sorted by tile id:
+//            id = z << 58 | x << 29 | y, offset and length of its data,
+//            flags: TILE_PRESENT for a tile with content, also an empty one
+//   data     tile contents, identical tiles stored once
+//
+// Version 1 archives have a 64 bit length and no flags, all their tiles
+// are present.
+//
+// The file is mapped and a tile is found by binary search over the index,
+// so serving one costs a few page touches and a copy. Zoom levels up to 29.
+class TileArchive {
+
+public:
+
+    // nullptr when _path is not a readable archive
+    static std::shared_ptr<TileArchive> open(const std::string& _path);
+
+    // Copy the content of _tile, false when the archive does not have it.
+    // A present tile may be empty
+    bool get(const TileCoord& _tile, std::vector<char>& _content) const;
+
+    size_t size() const { return m_count; }
+
+private:
+
+    // Little endian, the length of version 1 is read as length and flags 0
+    struct Record {
+        uint64_t id;
+        uint64_t offset;
+        uint32_t length;
+        uint32_t flags;
+    };
+
+    TileArchive() = default;
+
+    std::shared_ptr<FileView> m_file;
+    const Record* m_index = nullptr;
+    size_t m_count = 0;
+    uint32_t m_version = 0;
+};
+
+// Split archive://<file>/{z}/{x}/{y}[.ext] into the archive file and the tile
+bool parseArchiveUrl(const std::string& _url, std::string& _path, TileCoord& _tile);
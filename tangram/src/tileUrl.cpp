@@ -0,0 +1,216 @@
+#include "tileUrl.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <unordered_set>
+
+// Cost of one zoom level of difference, in tiles of distance
+#define ZOOM_PENALTY 4.f
+#define MAX_ZOOM 30
+
+// Parse the leading digits of [_begin, _end), requires at least one digit
+static bool parseInt(const std::string& _str, size_t _begin, size_t _end, bool _allowSuffix, int& _value) {
+    size_t pos = _begin;
+    long value = 0;
+    while (pos < _end && _str[pos] >= '0' && _str[pos] <= '9' && value < (1L << MAX_ZOOM)) {
+        value = value * 10 + (_str[pos] - '0');
+        pos++;
+    }
+    if (pos == _begin || value >= (1L << MAX_ZOOM)) { return false; }
+    if (pos != _end && !_allowSuffix) { return false; }
+
+    _value = int(value);
+    return true;
+}
+
+// Positions of the slashes before z, x and y and the end of the y segment
+static bool findTileSegments(const std::string& _url, size_t bounds[4], TileCoord& _tile) {
+
+    size_t end = _url.find_first_of("?#");
+    if (end == std::string::npos) { end = _url.size(); }
+
+    // Last three path segments
+    bounds[3] = end;
+    for (int i = 2; i >= 0; i--) {
+        size_t slash = _url.rfind('/', bounds[i + 1] - 1);
+        if (slash == std::string::npos || slash == 0) { return false; }
+        bounds[i] = slash;
+    }
+
+    TileCoord tile;
+    if (!parseInt(_url, bounds[0] + 1, bounds[1], false, tile.z) ||
+        !parseInt(_url, bounds[1] + 1, bounds[2], false, tile.x) ||
+        !parseInt(_url, bounds[2] + 1, bounds[3], true, tile.y)) {
+        return false;
+    }
+
+    int max = 1 << std::min(tile.z, MAX_ZOOM);
+    if (tile.z > MAX_ZOOM || tile.x >= max || tile.y >= max) { return false; }
+
+    _tile = tile;
+    return true;
+}
+
+bool parseTileUrl(const std::string& _url, TileCoord& _tile) {
+    size_t bounds[4];
+    return findTileSegments(_url, bounds, _tile);
+}
+
+bool tileUrlTemplate(const std::string& _url, std::string& _template) {
+    size_t bounds[4];
+    TileCoord tile;
+    if (!findTileSegments(_url, bounds, tile)) { return false; }
+
+    // Keep the extension after the digits of y
+    size_t yEnd = bounds[2] + 1;
+    while (yEnd < bounds[3] && _url[yEnd] >= '0' && _url[yEnd] <= '9') { yEnd++; }
+
+    _template = _url.substr(0, bounds[0] + 1) + "{z}/{x}/{y}" + _url.substr(yEnd);
+    return true;
+}
+
+std::string tileUrl(const std::string& _template, const TileCoord& _tile) {
+    std::string url = _template;
+
+    const std::pair<const char*, int> fields[] = { { "{z}", _tile.z }, { "{x}", _tile.x }, { "{y}", _tile.y } };
+    for (auto& field : fields) {
+        size_t pos = url.find(field.first);
+        if (pos != std::string::npos) {
+            url.replace(pos, 3, std::to_string(field.second));
+        }
+    }
+    return url;
+}
+
+// Position of _lng/_lat in tile units at zoom _z
+static void lngLatToTile(double _lng, double _lat, int _z, double& _x, double& _y) {
+    double n = std::pow(2.0, _z);
+    double lat = std::max(-85.0511, std::min(85.0511, _lat)) * M_PI / 180.0;
+
+    _x = (_lng + 180.0) / 360.0 * n;
+    _y = (1.0 - std::log(std::tan(lat) + 1.0 / std::cos(lat)) / M_PI) / 2.0 * n;
+}
+
+static int clampTile(double _t, int _z) {
+    return std::max(0, std::min((1 << _z) - 1, int(std::floor(_t))));
+}
+
+std::vector<TileCoord> tilesInBounds(double _minLng, double _minLat, double _maxLng, double _maxLat, int _z) {
+    std::vector<TileCoord> tiles;
+    if (_z < 0 || _z > MAX_ZOOM) { return tiles; }
+
+    // Tile y grows southwards
+    double x0, y0, x1, y1;
+    lngLatToTile(_minLng, _maxLat, _z, x0, y0);
+    lngLatToTile(_maxLng, _minLat, _z, x1, y1);
+
+    for (int y = clampTile(y0, _z); y <= clampTile(y1, _z); y++) {
+        for (int x = clampTile(x0, _z); x <= clampTile(x1, _z); x++) {
+            tiles.push_back({ x, y, _z });
+        }
+    }
+    return tiles;
+}
+
+std::vector<TileCoord> tilesInView(double _lng, double _lat, float _zoom, float _rotation, float _tilt,
+                                   int _width, int _height) {
+    std::vector<TileCoord> tiles;
+    if (_width <= 0 || _height <= 0) { return tiles; }
+
+    int z = std::max(0, std::min(MAX_ZOOM, int(std::floor(_zoom))));
+
+    double cx, cy;
+    lngLatToTile(_lng, _lat, z, cx, cy);
+
+    // Half the view in tiles of zoom z, 256 pixels at the integer zoom
+    double scale = 256.0 * std::pow(2.0, _zoom - z);
+    double halfWidth = _width / scale / 2.0;
+    double halfHeight = _height / scale / 2.0;
+
+    // Bounding box of the rotated view, grown for tilt in every direction
+    // since the horizon turns with the rotation
+    double c = std::abs(std::cos(_rotation));
+    double s = std::abs(std::sin(_rotation));
+    double reach = 1.0 / std::max(0.25, double(std::cos(_tilt)));
+    double hx = (halfWidth * c + halfHeight * s) * reach;
+    double hy = (halfWidth * s + halfHeight * c) * reach;
+
+    for (int y = clampTile(cy - hy, z); y <= clampTile(cy + hy, z); y++) {
+        for (int x = clampTile(cx - hx, z); x <= clampTile(cx + hx, z); x++) {
+            tiles.push_back({ x, y, z });
+        }
+    }
+    return tiles;
+}
+
+std::vector<TileCoord> tilesAlongRoute(const std::vector<std::pair<double, double>>& _route,
+                                       int _minZ, int _maxZ, int _radius) {
+
+    // Tiles with the distance along the route where they are first reached
+    std::vector<std::pair<double, TileCoord>> reached;
+
+    _minZ = std::max(0, _minZ);
+    _maxZ = std::min(MAX_ZOOM, _maxZ);
+
+    for (int z = _minZ; z <= _maxZ; z++) {
+        std::unordered_set<uint64_t> seen;
+        double distance = 0;
+
+        for (size_t i = 0; i < _route.size(); i++) {
+            double ax, ay, bx, by;
+            const auto& a = _route[i];
+            const auto& b = _route[std::min(i + 1, _route.size() - 1)];
+            lngLatToTile(a.first, a.second, z, ax, ay);
+            lngLatToTile(b.first, b.second, z, bx, by);
+
+            // Sample every half tile so that no tile on the way is skipped
+            double length = std::hypot(b.first - a.first, b.second - a.second);
+            int steps = int(std::ceil(std::max(std::abs(bx - ax), std::abs(by - ay)) * 2)) + 1;
+
+            for (int s = 0; s < steps; s++) {
+                double t = double(s) / steps;
+                int cx = clampTile(ax + (bx - ax) * t, z);
+                int cy = clampTile(ay + (by - ay) * t, z);
+
+                for (int dy = -_radius; dy <= _radius; dy++) {
+                    for (int dx = -_radius; dx <= _radius; dx++) {
+                        int x = cx + dx, y = cy + dy;
+                        if (x < 0 || y < 0 || x >= (1 << z) || y >= (1 << z)) { continue; }
+
+                        if (seen.insert((uint64_t(x) << 32) | uint32_t(y)).second) {
+                            reached.push_back({ distance + length * t, TileCoord{ x, y, z } });
+                        }
+                    }
+                }
+            }
+            distance += length;
+        }
+    }
+
+    // Interleave the zoom levels: what is reached first comes first
+    std::stable_sort(reached.begin(), reached.end(),
+                     [](const std::pair<double, TileCoord>& _a, const std::pair<double, TileCoord>& _b) {
+                         return _a.first < _b.first;
+                     });
+
+    std::vector<TileCoord> tiles;
+    tiles.reserve(reached.size());
+    for (auto& entry : reached) { tiles.push_back(entry.second); }
+    return tiles;
+}
+
+float tilePriority(const TileCoord& _tile, double _lng, double _lat, float _zoom) {
+
+    // View center in tile units at the zoom of _tile
+    double cx, cy;
+    lngLatToTile(_lng, _lat, _tile.z, cx, cy);
+
+    double dx = _tile.x + 0.5 - cx;
+    double dy = _tile.y + 0.5 - cy;
+
+    float zoomDelta = std::abs(float(_tile.z) - std::floor(_zoom));
+
+    return float(std::sqrt(dx * dx + dy * dy)) + zoomDelta * ZOOM_PENALTY;
+}
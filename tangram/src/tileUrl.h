@@ -0,0 +1,40 @@
+#pragma once
+
+#include <string>
+#include <utility>
+#include <vector>
+
+struct TileCoord {
+    int x = 0;
+    int y = 0;
+    int z = 0;
+};
+
+// Find the tile coordinates of a URL ending in .../{z}/{x}/{y}[.ext][?query]
+bool parseTileUrl(const std::string& _url, TileCoord& _tile);
+
+// Turn such a tile URL into a template with {z}, {x} and {y} in place of
+// the coordinates
+bool tileUrlTemplate(const std::string& _url, std::string& _template);
+
+// Fill the {z}, {x} and {y} placeholders of _template
+std::string tileUrl(const std::string& _template, const TileCoord& _tile);
+
+// Tiles at zoom _z covering the given bounds, row by row
+std::vector<TileCoord> tilesInBounds(double _minLng, double _minLat, double _maxLng, double _maxLat, int _z);
+
+// Tiles at the zoom level of a _width x _height pixel view centered on
+// _lng/_lat, with room for its rotation and for what a tilted view shows
+// towards the horizon (angles in radians)
+std::vector<TileCoord> tilesInView(double _lng, double _lat, float _zoom, float _rotation, float _tilt,
+                                   int _width, int _height);
+
+// Tiles from _minZ to _maxZ within _radius tiles of a route of lng/lat
+// points, in the order they are reached along the route
+std::vector<TileCoord> tilesAlongRoute(const std::vector<std::pair<double, double>>& _route,
+                                       int _minZ, int _maxZ, int _radius);
+
+// Fetch priority of a tile for a view centered on _lng/_lat at _zoom, lower
+// comes first: distance to the view center, in tiles, plus a penalty for
+// every zoom level between the tile and the view
+float tilePriority(const TileCoord& _tile, double _lng, double _lat, float _zoom);
@@ -0,0 +1,215 @@
+#include "trace.h"
+#include "log.h"
+
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <unistd.h>
+
+// Events kept per thread and trace, later ones are dropped
+#define EVENTS_PER_THREAD (1 << 16)
+
+struct TraceEvent {
+    const char* name;
+    const char* category;
+    char phase;             // 'X' slice, 's' flow start, 'f' flow end
+    int64_t start;          // steady clock, nanoseconds
+    int64_t duration;
+    uint64_t id;
+};
+
+// Written by its thread only, read when the trace stops
+struct ThreadBuffer {
+    uint32_t tid = 0;
+    const char* name = nullptr;
+    std::atomic<bool> owned{true};
+    std::atomic<uint64_t> session{0};
+    std::atomic<size_t> count{0};
+    std::atomic<uint64_t> dropped{0};
+    std::unique_ptr<TraceEvent[]> events{new TraceEvent[EVENTS_PER_THREAD]};
+};
+
+// Hands the buffer over once its thread exits
+struct BufferHandle {
+    ThreadBuffer* buffer = nullptr;
+    ~BufferHandle() {
+        if (buffer) { buffer->owned.store(false); }
+    }
+};
+
+std::atomic<bool> s_tracing(false);
+
+// Guards the buffer list, starting and stopping
+static std::mutex s_traceMutex;
+static std::vector<std::unique_ptr<ThreadBuffer>> s_buffers;
+static uint32_t s_nextTid = 1;
+static std::atomic<uint64_t> s_session(0);
+static std::atomic<uint64_t> s_nextFlow(1);
+static int64_t s_traceStart = 0;
+
+static thread_local BufferHandle t_handle;
+static thread_local const char* t_threadName = nullptr;
+
+static int64_t now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        TraceScope::Clock::now().time_since_epoch()).count();
+}
+
+// Only threads that record while a trace runs get a buffer
+static ThreadBuffer* threadBuffer() {
+    ThreadBuffer* buffer = t_handle.buffer;
+    uint64_t session = s_session.load(std::memory_order_acquire);
+
+    if (!buffer) {
+        std::lock_guard<std::mutex> lock(s_traceMutex);
+
+        // Reuse the buffer of an exited thread, unless it holds this trace
+        for (auto& candidate : s_buffers) {
+            if (!candidate->owned.load() && candidate->session.load() != session) {
+                buffer = candidate.get();
+                buffer->owned.store(true);
+                break;
+            }
+        }
+        if (!buffer) {
+            s_buffers.emplace_back(new ThreadBuffer());
+            buffer = s_buffers.back().get();
+        }
+        buffer->tid = s_nextTid++;
+        buffer->name = t_threadName;
+        buffer->count.store(0);
+        buffer->session.store(0);
+        t_handle.buffer = buffer;
+    }
+
+    if (buffer->session.load(std::memory_order_relaxed) != session) {
+        buffer->count.store(0, std::memory_order_relaxed);
+        buffer->dropped.store(0, std::memory_order_relaxed);
+        buffer->session.store(session, std::memory_order_release);
+    }
+    return buffer;
+}
+
+static void record(const TraceEvent& _event) {
+    ThreadBuffer* buffer = threadBuffer();
+
+    size_t count = buffer->count.load(std::memory_order_relaxed);
+    if (count >= EVENTS_PER_THREAD) {
+        buffer->dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    buffer->events[count] = _event;
+    // Publishes the event to stopTracing()
+    buffer->count.store(count + 1, std::memory_order_release);
+}
+
+void TraceScope::end() {
+    int64_t start = std::chrono::duration_cast<std::chrono::nanoseconds>(m_start.time_since_epoch()).count();
+    record({ m_name, m_category, 'X', start, now() - start, 0 });
+}
+
+void setTraceThreadName(const char* _name) {
+    t_threadName = _name;
+    if (t_handle.buffer) {
+        t_handle.buffer->name = _name;
+    }
+}
+
+uint64_t traceFlowStart(const char* _name) {
+    if (!isTracing()) { return 0; }
+
+    uint64_t id = s_nextFlow.fetch_add(1, std::memory_order_relaxed);
+    record({ _name, "flow", 's', now(), 0, id });
+    return id;
+}
+
+void traceFlowEnd(const char* _name, uint64_t _id) {
+    if (_id == 0 || !isTracing()) { return; }
+
+    record({ _name, "flow", 'f', now(), 0, _id });
+}
+
+void startTracing() {
+    std::lock_guard<std::mutex> lock(s_traceMutex);
+    if (s_tracing.load()) { return; }
+
+    s_traceStart = now();
+    s_session.fetch_add(1, std::memory_order_release);
+    s_tracing.store(true);
+}
+
+static void writeString(FILE* _file, const char* _string) {
+    fputc('"', _file);
+    for (const char* c = _string ? _string : ""; *c; c++) {
+        if (*c == '"' || *c == '\\') {
+            fputc('\\', _file);
+            fputc(*c, _file);
+        } else if (uint8_t(*c) >= 0x20) {
+            fputc(*c, _file);
+        }
+    }
+    fputc('"', _file);
+}
+
+bool stopTracing(const std::string& _path) {
+    std::lock_guard<std::mutex> lock(s_traceMutex);
+    if (!s_tracing.load()) { return false; }
+    s_tracing.store(false);
+
+    FILE* file = fopen(_path.c_str(), "w");
+    if (!file) {
+        LOGW("Cannot write trace %s", _path.c_str());
+        return false;
+    }
+
+    const uint64_t session = s_session.load();
+    const int pid = getpid();
+    uint64_t dropped = 0;
+    bool first = true;
+
+    fprintf(file, "{\"traceEvents\":[");
+    for (auto& buffer : s_buffers) {
+        if (buffer->session.load(std::memory_order_acquire) != session) { continue; }
+
+        size_t count = buffer->count.load(std::memory_order_acquire);
+        dropped += buffer->dropped.load(std::memory_order_relaxed);
+
+        if (buffer->name) {
+            fprintf(file, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%u,\"args\":{\"name\":",
+                    first ? "" : ",", pid, buffer->tid);
+            writeString(file, buffer->name);
+            fprintf(file, "}}");
+            first = false;
+        }
+
+        for (size_t i = 0; i < count; i++) {
+            const TraceEvent& event = buffer->events[i];
+
+            fprintf(file, "%s\n{\"name\":", first ? "" : ",");
+            writeString(file, event.name);
+            fprintf(file, ",\"cat\":");
+            writeString(file, event.category);
+            fprintf(file, ",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":%d,\"tid\":%u",
+                    event.phase, (event.start - s_traceStart) * 1e-3, pid, buffer->tid);
+
+            if (event.phase == 'X') {
+                fprintf(file, ",\"dur\":%.3f", event.duration * 1e-3);
+            } else {
+                // The flow ends in the slice enclosing it
+                fprintf(file, ",\"id\":%llu%s", (unsigned long long)event.id,
+                        event.phase == 'f' ? ",\"bp\":\"e\"" : "");
+            }
+            fprintf(file, "}");
+            first = false;
+        }
+    }
+    fprintf(file, "\n],\"displayTimeUnit\":\"ms\"}\n");
+
+    if (dropped > 0) {
+        LOGW("Trace dropped %llu events, more than %d on a thread", (unsigned long long)dropped, EVENTS_PER_THREAD);
+    }
+
+    return fclose(file) == 0;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+// Timeline of all threads in Chrome trace-event JSON, for chrome://tracing
+// or ui.perfetto.dev. Every thread records into a buffer of its own without
+// locking; buffers are merged when the trace stops. Names and categories
+// must be string literals, only their pointers are kept.
+//
+// While no trace runs, a scope costs one relaxed atomic load.
+
+extern std::atomic<bool> s_tracing;
+
+inline bool isTracing() {
+    return s_tracing.load(std::memory_order_relaxed);
+}
+
+void startTracing();
+// Write the events recorded since startTracing() to _path
+bool stopTracing(const std::string& _path);
+
+// Shown for the calling thread, recorded once per trace
+void setTraceThreadName(const char* _name);
+
+// Flows draw an arrow from the slice around traceFlowStart() to the one
+// around traceFlowEnd() with the same id, e.g. from a request to its
+// callback on another thread. Returns 0 while no trace runs
+uint64_t traceFlowStart(const char* _name);
+void traceFlowEnd(const char* _name, uint64_t _id);
+
+// Record a slice from construction to destruction
+class TraceScope {
+
+public:
+
+    using Clock = std::chrono::steady_clock;
+
+    explicit TraceScope(const char* _name, const char* _category = "tangram") {
+        if (isTracing()) {
+            m_name = _name;
+            m_category = _category;
+            m_start = Clock::now();
+        }
+    }
+
+    ~TraceScope() {
+        if (m_name) { end(); }
+    }
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+
+    void end();
+
+    const char* m_name = nullptr;
+    const char* m_category = nullptr;
+    Clock::time_point m_start;
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(...) TraceScope TRACE_CONCAT(traceScope, __LINE__)(__VA_ARGS__)
@@ -0,0 +1,739 @@
+#include "urlClient.h"
+#include "log.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cctype>
+#include <fcntl.h>
+#include <iterator>
+#include <unistd.h>
+
+// Upper bound for one curl_multi_wait(), the loop is woken earlier by the
+// wake pipe or by socket activity
+#define WAIT_TIMEOUT_MS 1000
+// Resolved hosts are shared by all transfers and resolved again after this,
+// so long-running displays follow DNS changes of CDN hosts
+#define DNS_CACHE_SECONDS 300L
+
+// Host and port of _url, requests are limited per host
+static std::string urlHost(const std::string& _url) {
+    size_t start = _url.find("://");
+    start = (start == std::string::npos) ? 0 : start + 3;
+
+    size_t end = _url.find_first_of("/?#", start);
+    std::string host = _url.substr(start, end == std::string::npos ? std::string::npos : end - start);
+
+    size_t userInfo = host.rfind('@');
+    if (userInfo != std::string::npos) {
+        host.erase(0, userInfo + 1);
+    }
+    std::transform(host.begin(), host.end(), host.begin(), ::tolower);
+    return host;
+}
+
+const std::string* UrlResponse::header(const std::string& _name) const {
+    for (auto& entry : headers) {
+        if (entry.first == _name) { return &entry.second; }
+    }
+    return nullptr;
+}
+
+UrlClient::UrlClient(Options _options, UrlResponseHandler _handler)
+    : m_options(_options), m_handler(_handler),
+      m_maxHostTransfers(_options.maxHostTransfers),
+      m_maxBytesPerSecond(_options.maxBytesPerSecond),
+      m_lastRefill(std::chrono::steady_clock::now()) {
+
+    m_multi = curl_multi_init();
+
+    curl_multi_setopt(m_multi, CURLMOPT_MAX_TOTAL_CONNECTIONS, long(m_options.maxTotalConnections));
+    curl_multi_setopt(m_multi, CURLMOPT_MAX_HOST_CONNECTIONS, long(m_options.maxHostConnections));
+    // Size of the connection cache: idle connections stay open for reuse
+    curl_multi_setopt(m_multi, CURLMOPT_MAXCONNECTS, long(m_options.maxTotalConnections));
+
+#ifdef CURLPIPE_MULTIPLEX
+    if (m_options.http2) {
+        curl_multi_setopt(m_multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+    }
+#endif
+
+    // The multi handle already pools connections, but every easy handle
+    // keeps its own TLS sessions: share them, and resolved hosts, so that
+    // a new connection to a known host resumes its session instead of doing
+    // a full handshake
+    m_share = curl_share_init();
+    curl_share_setopt(m_share, CURLSHOPT_LOCKFUNC, &UrlClient::onShareLock);
+    curl_share_setopt(m_share, CURLSHOPT_UNLOCKFUNC, &UrlClient::onShareUnlock);
+    curl_share_setopt(m_share, CURLSHOPT_USERDATA, this);
+    curl_share_setopt(m_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(m_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+
+    m_callbackPool.reset(new WorkerPool(std::max(1u, m_options.callbackThreads), "url callbacks"));
+
+    // Self-pipe to interrupt curl_multi_wait() when new work arrives
+    if (pipe(m_wakeFds) == 0) {
+        fcntl(m_wakeFds[0], F_SETFL, O_NONBLOCK);
+        fcntl(m_wakeFds[1], F_SETFL, O_NONBLOCK);
+    } else {
+        LOGE("Failed to create the network wake pipe");
+    }
+
+    m_thread = std::thread(&UrlClient::loop, this);
+}
+
+UrlClient::~UrlClient() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_running = false;
+        m_pending.clear();
+        m_queue.clear();
+        m_blocked.clear();
+        m_inflight.clear();
+    }
+    wake();
+
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+
+    // Drop responses not delivered yet
+    m_callbackPool.reset();
+
+    // Transfers still running are dropped without calling back
+    for (auto& transfer : m_active) {
+        curl_multi_remove_handle(m_multi, transfer->handle);
+        curl_easy_cleanup(transfer->handle);
+        curl_slist_free_all(transfer->headerList);
+    }
+    for (auto handle : m_idleHandles) {
+        curl_easy_cleanup(handle);
+    }
+    curl_multi_cleanup(m_multi);
+    curl_share_cleanup(m_share);
+
+    if (m_wakeFds[0] >= 0) { close(m_wakeFds[0]); }
+    if (m_wakeFds[1] >= 0) { close(m_wakeFds[1]); }
+}
+
+void UrlClient::addRequest(const std::string& _url, std::vector<std::string> _headers,
+                           UrlResponseCallback _callback, float _priority, bool _pinned) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        auto inflight = m_inflight.find(_url);
+        if (inflight != m_inflight.end()) {
+            (_pinned ? inflight->second.pinned : inflight->second.callbacks).push_back(_callback);
+            return;
+        }
+
+        auto pending = m_pending.find(_url);
+        if (pending != m_pending.end()) {
+            Task& task = pending->second;
+            if (_pinned) {
+                task.pinnedPriority = task.pinned.empty() ? _priority : std::min(task.pinnedPriority, _priority);
+                task.pinned.push_back(_callback);
+            } else {
+                task.callbacks.push_back(_callback);
+            }
+            // The most urgent requester decides the place in the queue
+            auto queue = queueOf(_url);
+            float priority;
+            if (queue && queue->priority(_url, priority) && _priority < priority) {
+                queue->update(_url, _priority);
+            }
+            return;
+        }
+
+        Task& task = m_pending[_url];
+        task.url = _url;
+        task.host = urlHost(_url);
+        task.headers = std::move(_headers);
+        task.queuedAt = std::chrono::steady_clock::now();
+        if (_pinned) {
+            task.pinned.push_back(_callback);
+            task.pinnedPriority = _priority;
+        } else {
+            task.callbacks.push_back(_callback);
+        }
+        m_queue.push(_url, _priority);
+    }
+    wake();
+}
+
+void UrlClient::addResponse(const std::string& _url, UrlResponse&& _response, UrlResponseCallback _callback) {
+    if (!_callback) { return; }
+
+    m_callbackPool->enqueue([_callback, response = std::move(_response)]() mutable {
+        _callback(std::move(response));
+    });
+}
+
+void UrlClient::cancelRequest(const std::string& _url) {
+    bool abort = false;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        auto pending = m_pending.find(_url);
+        if (pending != m_pending.end()) {
+            auto queue = queueOf(_url);
+            if (pending->second.pinned.empty()) {
+                if (queue) { queue->remove(_url); }
+                m_pending.erase(pending);
+            } else {
+                // Stays queued for the pinned requests, at their priority
+                pending->second.callbacks.clear();
+                if (queue) { queue->update(_url, pending->second.pinnedPriority); }
+            }
+        }
+
+        // The callbacks are dropped here, the transfer itself is removed
+        // from the multi handle by the event thread
+        auto inflight = m_inflight.find(_url);
+        if (inflight != m_inflight.end() && !inflight->second.pinned.empty()) {
+            inflight->second.callbacks.clear();
+        } else if (inflight != m_inflight.end()) {
+            m_cancelled.push_back(inflight->second.id);
+            m_inflight.erase(inflight);
+            abort = true;
+        }
+    }
+    if (abort) { wake(); }
+}
+
+void UrlClient::setPriority(const std::string& _url, float _priority) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (auto queue = queueOf(_url)) {
+        queue->update(_url, _priority);
+    }
+}
+
+void UrlClient::reprioritize(const PriorityFunction& _priority) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    for (auto& entry : m_pending) {
+        // Only pinned requests left, they keep their priority
+        if (entry.second.callbacks.empty()) { continue; }
+
+        if (auto queue = queueOf(entry.first)) {
+            queue->update(entry.first, _priority(entry.first));
+        }
+    }
+}
+
+void UrlClient::setLimits(uint32_t _maxHostTransfers, uint64_t _maxBytesPerSecond) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        m_maxHostTransfers = _maxHostTransfers;
+
+        // Blocked requests are checked against the new limit when they
+        // come up again
+        for (auto& blocked : m_blocked) {
+            blocked.second.forEach([&](const std::string& _url, float _priority) {
+                m_queue.push(_url, _priority);
+            });
+        }
+        m_blocked.clear();
+    }
+    m_maxBytesPerSecond = _maxBytesPerSecond;
+    wake();
+}
+
+UrlClient::Stats UrlClient::stats() const {
+    Stats stats;
+    stats.cancelled = m_cancelledCount;
+    stats.cancelledBytes = m_cancelledBytes;
+    stats.connectionsReused = m_connectionsReused;
+    stats.connectionsNew = m_connectionsNew;
+    stats.queueWait = m_queueWait.summary();
+    stats.dns = m_dns.summary();
+    stats.connect = m_connect.summary();
+    stats.tls = m_tls.summary();
+    stats.ttfb = m_ttfb.summary();
+    stats.total = m_total.summary();
+    stats.bytes = m_bytes.summary();
+    return stats;
+}
+
+void UrlClient::setTimingCallback(TimingCallback _callback) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_timingCallback = _callback;
+}
+
+bool UrlClient::popTask(Task& _task, TransferId& _id) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    while (!m_queue.empty()) {
+        std::string url = m_queue.top();
+        float priority = m_queue.topPriority();
+        uint64_t sequence = m_queue.topSequence();
+        m_queue.pop();
+
+        auto it = m_pending.find(url);
+        const std::string& host = it->second.host;
+
+        uint32_t& hostTransfers = m_hostTransfers[host];
+        if (m_maxHostTransfers > 0 && hostTransfers >= m_maxHostTransfers) {
+            // Wait for a transfer to this host to finish
+            m_blocked[host].push(url, priority, sequence);
+            continue;
+        }
+        hostTransfers++;
+
+        _task = std::move(it->second);
+        m_pending.erase(it);
+
+        // Later requests for the url join these callbacks
+        _id = m_nextTransferId++;
+        m_inflight[_task.url] = { _id, std::move(_task.callbacks), std::move(_task.pinned) };
+        return true;
+    }
+    return false;
+}
+
+void UrlClient::releaseHost(const std::string& _host) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto it = m_hostTransfers.find(_host);
+    if (it != m_hostTransfers.end() && --it->second == 0) {
+        m_hostTransfers.erase(it);
+    }
+
+    // The most urgent request held back for the host competes for the free
+    // slot again, in order of priority with all others. The rest stay put:
+    // every finished transfer frees one slot
+    auto blocked = m_blocked.find(_host);
+    if (blocked != m_blocked.end()) {
+        // May have been emptied by cancelRequest()
+        auto& queue = blocked->second;
+        if (!queue.empty()) {
+            m_queue.push(queue.top(), queue.topPriority(), queue.topSequence());
+            queue.pop();
+        }
+        if (queue.empty()) { m_blocked.erase(blocked); }
+    }
+}
+
+IndexedHeap<std::string, float>* UrlClient::queueOf(const std::string& _url) {
+    if (m_queue.contains(_url)) { return &m_queue; }
+
+    auto pending = m_pending.find(_url);
+    if (pending == m_pending.end()) { return nullptr; }
+
+    auto blocked = m_blocked.find(pending->second.host);
+    if (blocked != m_blocked.end() && blocked->second.contains(_url)) {
+        return &blocked->second;
+    }
+    return nullptr;
+}
+
+void UrlClient::wake() {
+    if (m_wakeFds[1] < 0) { return; }
+
+    char c = 1;
+    // A full pipe already guarantees a wake up
+    ssize_t n = write(m_wakeFds[1], &c, 1);
+    (void)n;
+}
+
+void UrlClient::loop() {
+    setTraceThreadName("url events");
+
+    while (true) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (!m_running) { break; }
+        }
+
+        abortCancelled();
+        startTransfers();
+        resumePaused();
+
+        int running = 0;
+        curl_multi_perform(m_multi, &running);
+
+        bool finished = false;
+        int queued = 0;
+        while (CURLMsg* msg = curl_multi_info_read(m_multi, &queued)) {
+            if (msg->msg == CURLMSG_DONE) {
+                finishTransfer(msg->easy_handle, msg->data.result);
+                finished = true;
+            }
+        }
+
+        // Freed slots are refilled right away
+        if (finished) { continue; }
+
+        curl_waitfd wakeFd = { m_wakeFds[0], CURL_WAIT_POLLIN, 0 };
+        int numFds = 0;
+        curl_multi_wait(m_multi, &wakeFd, m_wakeFds[0] >= 0 ? 1 : 0, throttleDelay(), &numFds);
+
+        if (wakeFd.revents) {
+            char buffer[64];
+            while (read(m_wakeFds[0], buffer, sizeof(buffer)) > 0) {}
+        }
+    }
+}
+
+void UrlClient::startTransfers() {
+    while (m_active.size() < m_options.maxActiveTransfers) {
+
+        Task task;
+        TransferId id;
+        if (!popTask(task, id)) { break; }
+
+        std::unique_ptr<Transfer> transfer(new Transfer());
+        transfer->id = id;
+        transfer->url = task.url;
+        transfer->host = task.host;
+        transfer->client = this;
+        transfer->queuedAt = task.queuedAt;
+        transfer->startedAt = std::chrono::steady_clock::now();
+
+        CURL* handle = acquireHandle();
+        transfer->handle = handle;
+
+        curl_easy_setopt(handle, CURLOPT_URL, transfer->url.c_str());
+        curl_easy_setopt(handle, CURLOPT_PRIVATE, transfer.get());
+        curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, &UrlClient::onData);
+        curl_easy_setopt(handle, CURLOPT_WRITEDATA, transfer.get());
+        curl_easy_setopt(handle, CURLOPT_HEADERFUNCTION, &UrlClient::onHeader);
+        curl_easy_setopt(handle, CURLOPT_HEADERDATA, transfer.get());
+        curl_easy_setopt(handle, CURLOPT_HEADER, 0L);
+        curl_easy_setopt(handle, CURLOPT_VERBOSE, 0L);
+        curl_easy_setopt(handle, CURLOPT_ACCEPT_ENCODING, "gzip");
+        curl_easy_setopt(handle, CURLOPT_NOSIGNAL, 1L);
+        curl_easy_setopt(handle, CURLOPT_FOLLOWLOCATION, 1L);
+        curl_easy_setopt(handle, CURLOPT_TCP_KEEPALIVE, 1L);
+        curl_easy_setopt(handle, CURLOPT_SHARE, m_share);
+        curl_easy_setopt(handle, CURLOPT_DNS_CACHE_TIMEOUT, DNS_CACHE_SECONDS);
+#ifdef CURLPIPE_MULTIPLEX
+        if (m_options.http2) {
+            curl_easy_setopt(handle, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
+            // Rather wait for a connection that can multiplex than open a new one
+            curl_easy_setopt(handle, CURLOPT_PIPEWAIT, 1L);
+        }
+#endif
+
+        for (auto& header : task.headers) {
+            transfer->headerList = curl_slist_append(transfer->headerList, header.c_str());
+        }
+        if (transfer->headerList) {
+            curl_easy_setopt(handle, CURLOPT_HTTPHEADER, transfer->headerList);
+        }
+
+        curl_multi_add_handle(m_multi, handle);
+        m_active.push_back(std::move(transfer));
+    }
+}
+
+void UrlClient::finishTransfer(CURL* _handle, CURLcode _result) {
+    TRACE_SCOPE("finishTransfer", "network");
+
+    auto it = std::find_if(m_active.begin(), m_active.end(),
+                           [&](const std::unique_ptr<Transfer>& _t) { return _t->handle == _handle; });
+
+    if (it == m_active.end()) { return; }
+
+    std::unique_ptr<Transfer> transfer = std::move(*it);
+    m_active.erase(it);
+
+    UrlResponse& response = transfer->response;
+    if (_result != CURLE_OK) {
+        logMsg("curl transfer failed: %s - %s\n", curl_easy_strerror(_result), transfer->url.c_str());
+        response.status = 0;
+    } else {
+        curl_easy_getinfo(_handle, CURLINFO_RESPONSE_CODE, &response.status);
+    }
+    if (response.status != 200) {
+        if (response.status != 0 && response.status != 304) {
+            logMsg("HTTP %ld - %s\n", response.status, transfer->url.c_str());
+        }
+        response.content.clear();
+    }
+
+    // Read before the handle is reset
+    Timing timing = recordTiming(*transfer, _result);
+
+    curl_multi_remove_handle(m_multi, _handle);
+    releaseHandle(_handle);
+    curl_slist_free_all(transfer->headerList);
+    transfer->headerList = nullptr;
+    releaseHost(transfer->host);
+
+    // Handling the response may write to disk or parse data, keep it off
+    // the event thread
+    m_callbackPool->enqueue([this, url = transfer->url, id = transfer->id,
+                             response = std::move(response), timing]() mutable {
+        deliverResponse(url, id, response, timing);
+    });
+}
+
+UrlClient::Timing UrlClient::recordTiming(const Transfer& _transfer, CURLcode _result) {
+    using namespace std::chrono;
+
+    Timing timing;
+    timing.status = _transfer.response.status;
+    timing.bytes = _transfer.response.content.size();
+    timing.queueWait = duration_cast<microseconds>(_transfer.startedAt - _transfer.queuedAt).count();
+
+    m_queueWait.record(timing.queueWait);
+
+    if (_result != CURLE_OK) { return timing; }
+
+    CURL* handle = _transfer.handle;
+
+    long connects = 0;
+    curl_easy_getinfo(handle, CURLINFO_NUM_CONNECTS, &connects);
+    if (connects == 0) {
+        m_connectionsReused++;
+    } else {
+        m_connectionsNew += connects;
+    }
+    timing.newConnection = connects > 0;
+
+    // End of each phase in microseconds since the start of the transfer
+#if LIBCURL_VERSION_NUM >= 0x073d00
+    curl_off_t value[5] = { 0, 0, 0, 0, 0 };
+    curl_easy_getinfo(handle, CURLINFO_NAMELOOKUP_TIME_T, &value[0]);
+    curl_easy_getinfo(handle, CURLINFO_CONNECT_TIME_T, &value[1]);
+    curl_easy_getinfo(handle, CURLINFO_APPCONNECT_TIME_T, &value[2]);
+    curl_easy_getinfo(handle, CURLINFO_STARTTRANSFER_TIME_T, &value[3]);
+    curl_easy_getinfo(handle, CURLINFO_TOTAL_TIME_T, &value[4]);
+#else
+    double seconds[5] = { 0, 0, 0, 0, 0 };
+    curl_easy_getinfo(handle, CURLINFO_NAMELOOKUP_TIME, &seconds[0]);
+    curl_easy_getinfo(handle, CURLINFO_CONNECT_TIME, &seconds[1]);
+    curl_easy_getinfo(handle, CURLINFO_APPCONNECT_TIME, &seconds[2]);
+    curl_easy_getinfo(handle, CURLINFO_STARTTRANSFER_TIME, &seconds[3]);
+    curl_easy_getinfo(handle, CURLINFO_TOTAL_TIME, &seconds[4]);
+
+    int64_t value[5];
+    for (int i = 0; i < 5; i++) { value[i] = int64_t(seconds[i] * 1e6); }
+#endif
+    uint64_t lookup = std::max<int64_t>(0, value[0]);
+    uint64_t connect = std::max<int64_t>(lookup, value[1]);
+    uint64_t handshake = std::max<int64_t>(0, value[2]);
+    uint64_t firstByte = std::max<int64_t>(0, value[3]);
+    uint64_t end = std::max<int64_t>(0, value[4]);
+
+    timing.ttfb = firstByte;
+    timing.total = end;
+    m_ttfb.record(timing.ttfb);
+    m_total.record(timing.total);
+    m_bytes.record(timing.bytes);
+
+    if (timing.newConnection) {
+        timing.dns = lookup;
+        timing.connect = connect - lookup;
+        // Zero for plain HTTP
+        timing.tls = handshake > connect ? handshake - connect : 0;
+        m_dns.record(timing.dns);
+        m_connect.record(timing.connect);
+        if (timing.tls) { m_tls.record(timing.tls); }
+    }
+    return timing;
+}
+
+void UrlClient::deliverResponse(const std::string& _url, TransferId _id, UrlResponse& _response,
+                                const Timing& _timing) {
+    TRACE_SCOPE("deliverResponse", "network");
+
+    bool retry = m_handler && !m_handler(_url, _response);
+
+    std::vector<UrlResponseCallback> callbacks;
+    std::vector<UrlResponseCallback> pinned;
+    TimingCallback timingCallback;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        timingCallback = m_timingCallback;
+
+        // Nothing to do when the request was cancelled meanwhile
+        auto it = m_inflight.find(_url);
+        if (it != m_inflight.end() && it->second.id == _id) {
+            callbacks = std::move(it->second.callbacks);
+            pinned = std::move(it->second.pinned);
+            m_inflight.erase(it);
+        }
+    }
+
+    if (timingCallback) {
+        timingCallback(_url, _timing);
+    }
+
+    if (retry) {
+        // Coalesced again into a single transfer, ahead of the queue
+        for (auto& callback : callbacks) {
+            if (callback) { addRequest(_url, {}, std::move(callback), 0, false); }
+        }
+        for (auto& callback : pinned) {
+            if (callback) { addRequest(_url, {}, std::move(callback), 0, true); }
+        }
+        return;
+    }
+
+    callbacks.insert(callbacks.end(),
+                     std::make_move_iterator(pinned.begin()),
+                     std::make_move_iterator(pinned.end()));
+
+    // Every callback but the last gets its own copy
+    for (size_t i = 0; i < callbacks.size(); i++) {
+        if (!callbacks[i]) { continue; }
+
+        if (i + 1 < callbacks.size()) {
+            UrlResponse copy = _response;
+            callbacks[i](std::move(copy));
+        } else {
+            callbacks[i](std::move(_response));
+        }
+    }
+}
+
+void UrlClient::abortCancelled() {
+    std::vector<TransferId> cancelled;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_cancelled.empty()) { return; }
+        cancelled.swap(m_cancelled);
+    }
+
+    for (TransferId id : cancelled) {
+        auto it = std::find_if(m_active.begin(), m_active.end(),
+                               [&](const std::unique_ptr<Transfer>& _t) { return _t->id == id; });
+
+        // Already finished
+        if (it == m_active.end()) { continue; }
+
+        CURL* handle = (*it)->handle;
+
+#if LIBCURL_VERSION_NUM >= 0x073700
+        curl_off_t expected = -1, received = 0;
+        curl_easy_getinfo(handle, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &expected);
+        curl_easy_getinfo(handle, CURLINFO_SIZE_DOWNLOAD_T, &received);
+#else
+        double expected = -1, received = 0;
+        curl_easy_getinfo(handle, CURLINFO_CONTENT_LENGTH_DOWNLOAD, &expected);
+        curl_easy_getinfo(handle, CURLINFO_SIZE_DOWNLOAD, &received);
+#endif
+
+        m_cancelledCount++;
+        if (expected > received) {
+            m_cancelledBytes += uint64_t(expected - received);
+        }
+
+        curl_multi_remove_handle(m_multi, handle);
+        releaseHandle(handle);
+        curl_slist_free_all((*it)->headerList);
+        releaseHost((*it)->host);
+        m_active.erase(it);
+    }
+}
+
+void UrlClient::resumePaused() {
+    const uint64_t rate = m_maxBytesPerSecond;
+
+    auto now = std::chrono::steady_clock::now();
+    double elapsed = std::chrono::duration<double>(now - m_lastRefill).count();
+    m_lastRefill = now;
+
+    if (rate == 0) {
+        m_tokens = 0;
+    } else {
+        // Bursts are bounded to a quarter second worth of data
+        m_tokens = std::min(rate * 0.25, m_tokens + elapsed * rate);
+        if (m_tokens <= 0) { return; }
+    }
+
+    for (auto& transfer : m_active) {
+        if (!transfer->paused) { continue; }
+
+        transfer->paused = false;
+        // Delivers the held back data right away, which may pause it again
+        curl_easy_pause(transfer->handle, CURLPAUSE_CONT);
+    }
+}
+
+long UrlClient::throttleDelay() const {
+    const uint64_t rate = m_maxBytesPerSecond;
+
+    bool paused = std::any_of(m_active.begin(), m_active.end(),
+                              [](const std::unique_ptr<Transfer>& _t) { return _t->paused; });
+
+    if (!paused || rate == 0) { return WAIT_TIMEOUT_MS; }
+
+    // Time until the bucket has tokens again
+    long delay = long(-m_tokens * 1000 / rate) + 1;
+    return std::max(1L, std::min(delay, long(WAIT_TIMEOUT_MS)));
+}
+
+CURL* UrlClient::acquireHandle() {
+    if (m_idleHandles.empty()) {
+        return curl_easy_init();
+    }
+    CURL* handle = m_idleHandles.back();
+    m_idleHandles.pop_back();
+    return handle;
+}
+
+void UrlClient::releaseHandle(CURL* _handle) {
+    // Reset options but keep the handle, with its caches, for the next transfer
+    curl_easy_reset(_handle);
+    m_idleHandles.push_back(_handle);
+}
+
+void UrlClient::onShareLock(CURL* _handle, curl_lock_data _data, curl_lock_access _access, void* _client) {
+    static_cast<UrlClient*>(_client)->m_shareMutex[_data].lock();
+}
+
+void UrlClient::onShareUnlock(CURL* _handle, curl_lock_data _data, void* _client) {
+    static_cast<UrlClient*>(_client)->m_shareMutex[_data].unlock();
+}
+
+size_t UrlClient::onData(char* _data, size_t _size, size_t _nmemb, void* _transfer) {
+    auto transfer = static_cast<Transfer*>(_transfer);
+    const size_t realSize = _size * _nmemb;
+
+    // Over the bandwidth limit: curl keeps the data and hands it over again
+    // once the event loop resumes the transfer
+    UrlClient* client = transfer->client;
+    if (client->m_maxBytesPerSecond != 0) {
+        if (client->m_tokens <= 0) {
+            transfer->paused = true;
+            return CURL_WRITEFUNC_PAUSE;
+        }
+        client->m_tokens -= realSize;
+    }
+
+    auto& content = transfer->response.content;
+    content.insert(content.end(), _data, _data + realSize);
+    return realSize;
+}
+
+size_t UrlClient::onHeader(char* _data, size_t _size, size_t _nmemb, void* _transfer) {
+    auto transfer = static_cast<Transfer*>(_transfer);
+    const size_t realSize = _size * _nmemb;
+
+    std::string line(_data, realSize);
+    auto& headers = transfer->response.headers;
+
+    // Status line of a new response (after a redirect or 100-continue)
+    if (line.compare(0, 5, "HTTP/") == 0) {
+        headers.clear();
+        return realSize;
+    }
+
+    size_t colon = line.find(':');
+    if (colon == std::string::npos) { return realSize; }
+
+    std::string name = line.substr(0, colon);
+    std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+
+    size_t begin = line.find_first_not_of(" \t", colon + 1);
+    size_t end = line.find_last_not_of(" \t\r\n");
+    std::string value = (begin == std::string::npos || end < begin) ? "" : line.substr(begin, end - begin + 1);
+
+    headers.emplace_back(std::move(name), std::move(value));
+    return realSize;
+}
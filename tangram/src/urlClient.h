@@ -0,0 +1,254 @@
+#pragma once
+
+#include "platform.h"
+#include "histogram.h"
+#include "indexedHeap.h"
+#include "workerPool.h"
+
+#include <curl/curl.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+struct UrlResponse {
+    // HTTP status code, 0 when the transfer failed
+    long status = 0;
+    std::vector<char> content;
+    // Header names are stored in lower case
+    std::vector<std::pair<std::string, std::string>> headers;
+
+    const std::string* header(const std::string& _name) const;
+};
+
+using UrlResponseCallback = std::function<void(UrlResponse&&)>;
+
+// Called once for every finished transfer, before its response is handed
+// to the callbacks of the request. Returning false drops the response and
+// sends the request again without its extra headers, e.g. when a 304 came
+// back for a cache entry that is gone meanwhile
+using UrlResponseHandler = std::function<bool(const std::string& _url, UrlResponse& _response)>;
+
+// Network backend behind startUrlRequest(): one curl multi handle driven by
+// its own event thread. Connections are kept alive between transfers and,
+// when the server supports it, transfers to the same host are multiplexed
+// over a single HTTP/2 connection. Requests for a url that is already queued
+// or being transferred attach to it, and one download is fanned out to all
+// of their callbacks.
+//
+// The event thread only moves bytes: as soon as a transfer finishes it starts
+// the next queued one, while response handling and callbacks run on a small
+// pool of callback threads. Nothing depends on the render loop.
+class UrlClient {
+
+public:
+
+    struct Options {
+        // Transfers running at the same time, the rest wait in the queue
+        uint32_t maxActiveTransfers = 32;
+        // Open connections allowed per host and in total
+        uint32_t maxHostConnections = 6;
+        uint32_t maxTotalConnections = 32;
+        // Ask for HTTP/2 and multiplex transfers on one connection
+        bool http2 = true;
+        // Threads running the response handler and request callbacks
+        uint32_t callbackThreads = 2;
+        // Transfers running at the same time to one host, 0 for no limit
+        uint32_t maxHostTransfers = 0;
+        // Download rate of all transfers together, 0 for no limit
+        uint64_t maxBytesPerSecond = 0;
+    };
+
+    struct Stats {
+        uint64_t cancelled = 0;
+        // Bytes announced by the server but never downloaded because the
+        // transfer was cancelled
+        uint64_t cancelledBytes = 0;
+        // Finished transfers that went over an open connection, and
+        // connections opened (with DNS lookup and TLS handshake)
+        uint64_t connectionsReused = 0;
+        uint64_t connectionsNew = 0;
+
+        // Distributions over finished transfers, in microseconds and bytes.
+        // dns, connect and tls only count transfers that opened a connection
+        Histogram::Summary queueWait;
+        Histogram::Summary dns;
+        Histogram::Summary connect;
+        Histogram::Summary tls;
+        Histogram::Summary ttfb;
+        Histogram::Summary total;
+        Histogram::Summary bytes;
+    };
+
+    // Lifecycle of one transfer, times in microseconds
+    struct Timing {
+        long status = 0;
+        uint64_t bytes = 0;
+        uint64_t queueWait = 0;     // from addRequest() until the transfer started
+        uint64_t dns = 0;
+        uint64_t connect = 0;
+        uint64_t tls = 0;
+        uint64_t ttfb = 0;          // from the start of the transfer to its first byte
+        uint64_t total = 0;         // from the start of the transfer to its end
+        bool newConnection = false;
+    };
+
+    using TimingCallback = std::function<void(const std::string& _url, const Timing& _timing)>;
+
+    explicit UrlClient(Options _options, UrlResponseHandler _handler = nullptr);
+    ~UrlClient();
+
+    using PriorityFunction = std::function<float(const std::string& _url)>;
+
+    // Queued requests start in order of priority, lowest first. _headers are
+    // extra request header lines, e.g. "If-None-Match: ..."
+    // A _pinned request, e.g. a prefetch, is not dropped by cancelRequest():
+    // only the other callbacks for the url are
+    void addRequest(const std::string& _url, std::vector<std::string> _headers,
+                    UrlResponseCallback _callback, float _priority = 0, bool _pinned = false);
+
+    // Hand a response that needs no transfer, e.g. from a cache, to the
+    // callback threads so that it reaches _callback like any other
+    void addResponse(const std::string& _url, UrlResponse&& _response, UrlResponseCallback _callback);
+
+    // Drop the request for _url. A transfer already running is aborted and
+    // its slot handed to the next queued request, unless the url also has
+    // pinned requests
+    void cancelRequest(const std::string& _url);
+
+    // Move the queued request for _url to a new place in the queue
+    void setPriority(const std::string& _url, float _priority);
+
+    // Recompute the priority of every queued request, e.g. after the view moved
+    void reprioritize(const PriorityFunction& _priority);
+
+    // Change Options::maxHostTransfers and Options::maxBytesPerSecond
+    void setLimits(uint32_t _maxHostTransfers, uint64_t _maxBytesPerSecond);
+
+    Stats stats() const;
+
+    // Called on a callback thread with the timing of every finished
+    // transfer, e.g. to log them
+    void setTimingCallback(TimingCallback _callback);
+
+private:
+
+    using TransferId = uint64_t;
+
+    struct Task {
+        std::string url;
+        std::string host;
+        std::vector<std::string> headers;
+        std::vector<UrlResponseCallback> callbacks;
+        std::vector<UrlResponseCallback> pinned;
+        float pinnedPriority = 0;
+        std::chrono::steady_clock::time_point queuedAt;
+    };
+
+    struct Transfer {
+        TransferId id = 0;
+        CURL* handle = nullptr;
+        curl_slist* headerList = nullptr;
+        std::string url;
+        std::string host;
+        UrlClient* client = nullptr;
+        // Held back by the bandwidth limit
+        bool paused = false;
+        std::chrono::steady_clock::time_point queuedAt;
+        std::chrono::steady_clock::time_point startedAt;
+        UrlResponse response;
+    };
+
+    struct Inflight {
+        TransferId id;
+        std::vector<UrlResponseCallback> callbacks;
+        std::vector<UrlResponseCallback> pinned;
+    };
+
+    void loop();
+    void wake();
+
+    void startTransfers();
+    bool popTask(Task& _task, TransferId& _id);
+    void releaseHost(const std::string& _host);
+    // Queue holding the pending request for _url: the main one or the
+    // queue of requests blocked by the limit of their host
+    IndexedHeap<std::string, float>* queueOf(const std::string& _url);
+
+    void resumePaused();
+    long throttleDelay() const;
+    void finishTransfer(CURL* _handle, CURLcode _result);
+    Timing recordTiming(const Transfer& _transfer, CURLcode _result);
+    void deliverResponse(const std::string& _url, TransferId _id, UrlResponse& _response, const Timing& _timing);
+    void abortCancelled();
+
+    CURL* acquireHandle();
+    void releaseHandle(CURL* _handle);
+
+    static void onShareLock(CURL* _handle, curl_lock_data _data, curl_lock_access _access, void* _client);
+    static void onShareUnlock(CURL* _handle, curl_lock_data _data, void* _client);
+
+    static size_t onData(char* _data, size_t _size, size_t _nmemb, void* _transfer);
+    static size_t onHeader(char* _data, size_t _size, size_t _nmemb, void* _transfer);
+
+    const Options m_options;
+    const UrlResponseHandler m_handler;
+    CURLM* m_multi = nullptr;
+    // DNS and TLS session caches used by all easy handles
+    CURLSH* m_share = nullptr;
+    std::mutex m_shareMutex[CURL_LOCK_DATA_LAST];
+
+    // Shared with the calling threads
+    std::mutex m_mutex;
+    // Queued requests by url
+    std::unordered_map<std::string, Task> m_pending;
+    IndexedHeap<std::string, float> m_queue;
+    // Queued requests for hosts at their transfer limit, by host
+    std::unordered_map<std::string, IndexedHeap<std::string, float>> m_blocked;
+    // Running transfers by host
+    std::unordered_map<std::string, uint32_t> m_hostTransfers;
+    uint32_t m_maxHostTransfers;
+    // Callbacks waiting for transfers in progress, by url
+    std::unordered_map<std::string, Inflight> m_inflight;
+    // Transfers to abort on the event thread
+    std::vector<TransferId> m_cancelled;
+    TransferId m_nextTransferId = 0;
+    bool m_running = true;
+    TimingCallback m_timingCallback;
+
+    std::atomic<uint64_t> m_cancelledCount{0};
+    std::atomic<uint64_t> m_cancelledBytes{0};
+    std::atomic<uint64_t> m_connectionsReused{0};
+    std::atomic<uint64_t> m_connectionsNew{0};
+
+    Histogram m_queueWait;
+    Histogram m_dns;
+    Histogram m_connect;
+    Histogram m_tls;
+    Histogram m_ttfb;
+    Histogram m_total;
+    Histogram m_bytes;
+
+    // Owned by the event thread
+    std::vector<std::unique_ptr<Transfer>> m_active;
+    std::vector<CURL*> m_idleHandles;
+
+    // Token bucket of the bandwidth limit, in bytes
+    std::atomic<uint64_t> m_maxBytesPerSecond;
+    double m_tokens = 0;
+    std::chrono::steady_clock::time_point m_lastRefill;
+
+    int m_wakeFds[2] = { -1, -1 };
+    std::thread m_thread;
+
+    // Last member: destroyed, and joined, before the state its jobs use
+    std::unique_ptr<WorkerPool> m_callbackPool;
+};
@@ -0,0 +1,48 @@
+#include "workerPool.h"
+#include "trace.h"
+
+WorkerPool::WorkerPool(uint32_t _numThreads, const char* _name) : m_name(_name) {
+    for (uint32_t i = 0; i < _numThreads; i++) {
+        m_threads.emplace_back(&WorkerPool::run, this);
+    }
+}
+
+WorkerPool::~WorkerPool() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_running = false;
+        m_jobs.clear();
+    }
+    m_condition.notify_all();
+
+    for (auto& thread : m_threads) {
+        thread.join();
+    }
+}
+
+void WorkerPool::enqueue(std::function<void()> _job) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_running) { return; }
+        m_jobs.push_back(std::move(_job));
+    }
+    m_condition.notify_one();
+}
+
+void WorkerPool::run() {
+    setTraceThreadName(m_name);
+
+    while (true) {
+        std::function<void()> job;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_condition.wait(lock, [this] { return !m_running || !m_jobs.empty(); });
+
+            if (!m_running) { return; }
+
+            job = std::move(m_jobs.front());
+            m_jobs.pop_front();
+        }
+        job();
+    }
+}
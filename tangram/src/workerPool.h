@@ -0,0 +1,36 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of threads running jobs from a shared queue in FIFO order
+class WorkerPool {
+
+public:
+
+    // _name labels the threads in traces, a string literal
+    explicit WorkerPool(uint32_t _numThreads, const char* _name = "worker");
+
+    // Jobs still queued are dropped, running ones are waited for
+    ~WorkerPool();
+
+    void enqueue(std::function<void()> _job);
+
+private:
+
+    void run();
+
+    const char* m_name;
+
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    std::deque<std::function<void()>> m_jobs;
+    bool m_running = true;
+
+    std::vector<std::thread> m_threads;
+};